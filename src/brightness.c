@@ -1,125 +1,410 @@
 #include "brightness.h"
+#include "command.h"
 #include "config.h"
+#include "trace.h"
 
 #include <glib.h>
+#include <math.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <libudev.h>
 #include <sys/inotify.h>
 
+typedef struct {
+    gint fd;
+    // Backlight device name, used to match udev events
+    gchar *sysname;
+    // max_brightness of the target, or -1 if it could not be read
+    gint max;
+    // Target value for every source value from 0 to source_max, or NULL to
+    // copy the source value unchanged
+    gint *map;
+    // Source value for every target value from 0 to max, for bidirectional sync
+    gint *unmap;
+    // Value last written by the daemon or read back, -1 if unknown
+    gint last;
+} target_t;
+
+// Origin of a pending change that did not come from a target
+#define ORIGIN_SOURCE -1
+
 static GIOChannel *inotify_channel = NULL;
+static guint inotify_watch_id = 0;
 static gint inotify_fd = -1;
-static gint target_fd = -1;
-static gchar *last_brightness = NULL;
+static GIOChannel *udev_channel = NULL;
+static guint udev_watch_id = 0;
+static struct udev *udev_ctx = NULL;
+static struct udev_monitor *udev_monitor = NULL;
+static gchar *source_sysname = NULL;
+static GIOChannel *actual_channel = NULL;
+static guint actual_watch_id = 0;
+static gint source_fd = -1;
+static target_t *targets = NULL;
+static guint target_count = 0;
+static gint source_max = -1;
+static gint pending_brightness = -1;
+static gint pending_origin = ORIGIN_SOURCE;
+static gint64 last_flush = 0;
+static guint flush_id = 0;
+static gint last_brightness = -1;
+// The input event the pending brightness is traced under
+static guint pending_trace_id = 0;
+static gint64 pending_trace_start = 0;
 static const duet_config_t *config = NULL;
 
-// Read current brightness value from source file
-static gchar *read_brightness(void) {
-    gchar *content = NULL;
-    GError *error = NULL;
-    
-    if (!config || !config->source_display) {
-        g_printerr("No config or source display path available\n");
-        return NULL;
+// Raw events, wakeups that read the source and writes made
+static brightness_stats_t stats;
+
+// Read current brightness value from a brightness file. Runs on every event, so
+// it reads with pread on a persistent fd and parses in place without allocating.
+static gint read_brightness(gint fd, const gchar *path) {
+    char buffer[32];
+    ssize_t length = pread(fd, buffer, sizeof(buffer) - 1, 0);
+    if (length == -1) {
+        g_printerr("Failed to read brightness: %s\n", g_strerror(errno));
+        return -1;
     }
     
-    if (!g_file_get_contents(config->source_display, &content, NULL, &error)) {
-        g_printerr("Failed to read brightness: %s\n", error->message);
-        g_error_free(error);
-        return NULL;
+    gint value = 0;
+    ssize_t i = 0;
+    for (; i < length && g_ascii_isdigit(buffer[i]); i++) {
+        value = value * 10 + (buffer[i] - '0');
     }
-    
-    // Remove trailing newline if present
-    g_strchomp(content);
-    return content;
+    if (i == 0) {
+        g_printerr("Invalid brightness value in %s\n", path);
+        return -1;
+    }
+    return value;
 }
 
-// Write brightness value to target file
-static gboolean write_brightness(const gchar *brightness) {
-    if (!brightness) return FALSE;
-    
-    if (!config || !config->target_display) {
-        g_printerr("No config or target display path available\n");
-        return FALSE;
+// Reads max_brightness next to the given brightness file, or -1 on failure
+static gint read_max_brightness(const gchar *brightness_path) {
+    gchar *dir = g_path_get_dirname(brightness_path);
+    gchar *path = g_build_filename(dir, "max_brightness", NULL);
+    gchar *contents = NULL;
+    gint max = -1;
+    if (g_file_get_contents(path, &contents, NULL, NULL)) {
+        gint64 value = g_ascii_strtoll(contents, NULL, 10);
+        if (value > 0 && value <= G_MAXINT) {
+            max = value;
+        }
+    } else {
+        g_printerr("Could not read %s, copying brightness values unscaled\n", path);
     }
-    
-    if (target_fd == -1) {
-        target_fd = open(config->target_display, O_WRONLY);
-        if (target_fd == -1) {
-            g_printerr("Failed to open target brightness file: %s\n", g_strerror(errno));
-            return FALSE;
+    g_free(contents);
+    g_free(path);
+    g_free(dir);
+    return max;
+}
+
+// Precomputes the source to target mapping for every target so events only
+// need a table lookup
+static void build_maps(void) {
+    source_max = read_max_brightness(config->source_display);
+    for (guint i = 0; i < target_count; i++) {
+        target_t *target = &targets[i];
+        g_free(target->map);
+        g_free(target->unmap);
+        target->map = NULL;
+        target->unmap = NULL;
+        target->max = read_max_brightness(config->target_displays[i]);
+        if (source_max == -1 || target->max == -1) {
+            continue;
+        }
+        
+        target->map = g_new(gint, source_max + 1);
+        for (gint value = 0; value <= source_max; value++) {
+            gdouble level = pow((gdouble)value / source_max, config->brightness_gamma);
+            gint mapped = (gint)(level * target->max + 0.5);
+            // A lit source never turns the target off
+            target->map[value] = value > 0 && mapped == 0 ? 1 : mapped;
         }
+        
+        // The map is monotonic, so the inverse is the first source value
+        // that reaches each target value
+        if (config->bidirectional) {
+            target->unmap = g_new(gint, target->max + 1);
+            gint value = 0;
+            for (gint mapped = 0; mapped <= target->max; mapped++) {
+                while (value < source_max && target->map[value] < mapped) {
+                    value++;
+                }
+                target->unmap[mapped] = value;
+            }
+        }
+        g_print("Mapping brightness 0-%d to 0-%d on %s (gamma %.2f)\n", source_max,
+                target->max, config->target_displays[i], config->brightness_gamma);
     }
-    
-    // Write the brightness value
-    ssize_t written = write(target_fd, brightness, strlen(brightness));
+}
+
+static void free_maps(void) {
+    for (guint i = 0; i < target_count; i++) {
+        g_free(targets[i].map);
+        g_free(targets[i].unmap);
+        targets[i].map = NULL;
+        targets[i].unmap = NULL;
+    }
+}
+
+static gint to_target(const target_t *target, gint value) {
+    return target->map ? target->map[MIN(value, source_max)] : value;
+}
+
+static gint to_source(const target_t *target, gint value) {
+    return target->unmap ? target->unmap[MIN(value, target->max)] : value;
+}
+
+// Write brightness value to a brightness file
+static gboolean write_brightness(gint fd, const char *buffer, int length) {
+    // sysfs attributes are rewritten from offset 0 on every write
+    ssize_t written = pwrite(fd, buffer, length, 0);
     if (written == -1) {
         g_printerr("Failed to write brightness: %s\n", g_strerror(errno));
         return FALSE;
     }
     
+    stats.writes++;
     return TRUE;
 }
 
+// Writes the pending brightness to every panel but the one it came from in one
+// pass. The values written are remembered so their echoes are ignored.
+static void flush_brightness(void) {
+    if (pending_brightness == -1) {
+        return;
+    }
+    
+    char buffer[16];
+    int length;
+    if (pending_origin != ORIGIN_SOURCE) {
+        length = snprintf(buffer, sizeof(buffer), "%d", pending_brightness);
+        write_brightness(source_fd, buffer, length);
+        last_brightness = pending_brightness;
+    }
+    for (guint i = 0; i < target_count; i++) {
+        target_t *target = &targets[i];
+        if ((gint)i == pending_origin) {
+            continue;
+        }
+        target->last = to_target(target, pending_brightness);
+        length = snprintf(buffer, sizeof(buffer), "%d", target->last);
+        write_brightness(target->fd, buffer, length);
+    }
+    
+    pending_brightness = -1;
+    last_flush = g_get_monotonic_time();
+    trace_stage(pending_trace_id, "brightness write", pending_trace_start, last_flush);
+    pending_trace_id = 0;
+}
+
+static gboolean flush_timeout(gpointer data) {
+    flush_id = 0;
+    flush_brightness();
+    command_publish_state();
+    return G_SOURCE_REMOVE;
+}
+
+// Queues value, in source units, to be written to every panel but origin.
+// Passes over the panels are limited to MAX_WRITES_PER_SECOND; values
+// superseded in between are dropped, but the last one is always written.
+// The write is traced under trace_id, the event that caused it.
+static void schedule_flush(gint value, gint origin, guint trace_id) {
+    if (pending_brightness != -1) {
+        stats.saved += target_count;
+    }
+    pending_brightness = value;
+    pending_origin = origin;
+    pending_trace_id = trace_id;
+    pending_trace_start = g_get_monotonic_time();
+    // Subscribers see every value, including ones a rate limited pass drops
+    command_publish_state();
+    if (flush_id) {
+        return;
+    }
+    
+    gint64 wait = 0;
+    if (config->max_writes_per_second > 0) {
+        wait = last_flush + G_USEC_PER_SEC / config->max_writes_per_second - g_get_monotonic_time();
+    }
+    if (wait <= 0) {
+        flush_brightness();
+    } else {
+        flush_id = g_timeout_add((wait + 999) / 1000, flush_timeout, NULL);
+    }
+}
+
+// Propagates a brightness change if there is one. Called once per wakeup
+// however many events were pending. In bidirectional mode the targets are
+// checked too; a panel reading back the value the daemon last wrote to it is
+// an echo of that write and is ignored, so one adjustment causes exactly one
+// write per other panel.
+static void sync_brightness(guint trace_id) {
+    stats.syncs++;
+    gint current_brightness = read_brightness(source_fd, config->source_display);
+    if (current_brightness != -1 && current_brightness != last_brightness) {
+        last_brightness = current_brightness;
+        schedule_flush(current_brightness, ORIGIN_SOURCE, trace_id);
+        return;
+    }
+    
+    if (!config->bidirectional) {
+        return;
+    }
+    for (guint i = 0; i < target_count; i++) {
+        target_t *target = &targets[i];
+        gint value = read_brightness(target->fd, config->target_displays[i]);
+        if (value != -1 && value != target->last) {
+            target->last = value;
+            schedule_flush(to_source(target, value), i, trace_id);
+            return;
+        }
+    }
+    stats.echoes++;
+}
+
 // Inotify event callback
 static gboolean inotify_event(GIOChannel *source, GIOCondition condition, gpointer data) {
     if (condition & G_IO_IN) {
-        char buffer[4096];
+        char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
         ssize_t length = read(inotify_fd, buffer, sizeof(buffer));
         
-        if (length > 0) {
-            struct inotify_event *event = (struct inotify_event *)buffer;
-            
-            // Check if this is a modify event
+        // Count every modify event in the batch, then sync once
+        guint64 modified = 0;
+        for (char *ptr = buffer; ptr < buffer + length;) {
+            const struct inotify_event *event = (const struct inotify_event *)ptr;
             if (event->mask & IN_MODIFY) {
-                gchar *current_brightness = read_brightness();
-                if (!current_brightness) {
-                    return G_SOURCE_CONTINUE;
-                }
-                
-                // Check if brightness actually changed
-                if (!last_brightness || g_strcmp0(last_brightness, current_brightness) != 0) {
-                    g_free(last_brightness);
-                    last_brightness = current_brightness;
-                    
-                    g_print("Brightness changed to: %s\n", current_brightness);
-                    
-                    if (write_brightness(current_brightness)) {
-                        g_print("Synced brightness to intel backlight\n");
-                    } else {
-                        g_printerr("Failed to sync brightness\n");
-                    }
-                } else {
-                    g_free(current_brightness);
-                }
+                modified++;
             }
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+        
+        if (modified) {
+            guint trace_id = trace_event("brightness inotify");
+            stats.events += modified;
+            sync_brightness(trace_id);
         }
     }
     
     return G_SOURCE_CONTINUE;
 }
 
-gboolean brightness_watch(duet_config_t *cfg) {
-    // Get config from display module
-    config = cfg;
-    if (!config) {
-        g_printerr("No config available for brightness sync\n");
+// Whether a backlight device is one whose changes are propagated
+static gboolean is_watched_panel(const gchar *sysname) {
+    if (g_strcmp0(sysname, source_sysname) == 0) {
+        return TRUE;
+    }
+    for (guint i = 0; config->bidirectional && i < target_count; i++) {
+        if (g_strcmp0(sysname, targets[i].sysname) == 0) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+// Udev event callback: the backlight core sends a change uevent for every
+// brightness change, including hotkey and firmware driven ones
+static gboolean udev_event(GIOChannel *source, GIOCondition condition, gpointer data) {
+    // Drain every queued uevent, then sync once
+    guint64 changed = 0;
+    struct udev_device *dev;
+    while ((dev = udev_monitor_receive_device(udev_monitor))) {
+        if (g_strcmp0(udev_device_get_action(dev), "change") == 0 &&
+            is_watched_panel(udev_device_get_sysname(dev))) {
+            changed++;
+        }
+        udev_device_unref(dev);
+    }
+    
+    if (changed) {
+        guint trace_id = trace_event("brightness udev");
+        stats.events += changed;
+        sync_brightness(trace_id);
+    }
+    
+    return G_SOURCE_CONTINUE;
+}
+
+// actual_brightness callback: sysfs_notify() wakes POLLPRI pollers
+static gboolean actual_brightness_event(GIOChannel *source, GIOCondition condition, gpointer data) {
+    // Reading the attribute re-arms the notification
+    char buffer[32];
+    if (pread(g_io_channel_unix_get_fd(source), buffer, sizeof(buffer), 0) == -1) {
+        g_printerr("Failed to read actual_brightness: %s\n", g_strerror(errno));
+    }
+    
+    guint trace_id = trace_event("brightness sysfs");
+    stats.events++;
+    sync_brightness(trace_id);
+    return G_SOURCE_CONTINUE;
+}
+
+static gchar *panel_sysname(const gchar *brightness_path) {
+    gchar *dir = g_path_get_dirname(brightness_path);
+    gchar *sysname = g_path_get_basename(dir);
+    g_free(dir);
+    return sysname;
+}
+
+// Watches the backlights' udev change events
+static gboolean watch_udev(void) {
+    source_sysname = panel_sysname(config->source_display);
+    for (guint i = 0; i < target_count; i++) {
+        targets[i].sysname = panel_sysname(config->target_displays[i]);
+    }
+    
+    udev_ctx = udev_new();
+    if (!udev_ctx) {
+        return FALSE;
+    }
+    udev_monitor = udev_monitor_new_from_netlink(udev_ctx, "udev");
+    if (!udev_monitor ||
+        udev_monitor_filter_add_match_subsystem_devtype(udev_monitor, "backlight", NULL) < 0 ||
+        udev_monitor_enable_receiving(udev_monitor) < 0) {
+        g_printerr("Failed to monitor backlight udev events\n");
         return FALSE;
     }
     
-    // Check if source file exists
-    if (!g_file_test(config->source_display, G_FILE_TEST_EXISTS)) {
-        g_printerr("Source brightness file does not exist: %s\n", config->source_display);
+    int fd = udev_monitor_get_fd(udev_monitor);
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    
+    udev_channel = g_io_channel_unix_new(fd);
+    g_io_channel_set_encoding(udev_channel, NULL, NULL);
+    udev_watch_id = g_io_add_watch(udev_channel, G_IO_IN, udev_event, NULL);
+    return TRUE;
+}
+
+// Watches the source backlight's actual_brightness for sysfs notifications
+static gboolean watch_actual_brightness(void) {
+    gchar *dir = g_path_get_dirname(config->source_display);
+    gchar *path = g_build_filename(dir, "actual_brightness", NULL);
+    g_free(dir);
+    
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    g_free(path);
+    if (fd == -1) {
         return FALSE;
     }
     
-    // Check if target file exists
-    if (!g_file_test(config->target_display, G_FILE_TEST_EXISTS)) {
-        g_printerr("Target brightness file does not exist: %s\n", config->target_display);
+    // The attribute must be read once before poll reports notifications
+    char buffer[32];
+    if (pread(fd, buffer, sizeof(buffer), 0) == -1) {
+        close(fd);
         return FALSE;
     }
     
+    actual_channel = g_io_channel_unix_new(fd);
+    g_io_channel_set_encoding(actual_channel, NULL, NULL);
+    g_io_channel_set_close_on_unref(actual_channel, TRUE);
+    actual_watch_id = g_io_add_watch(actual_channel, G_IO_PRI | G_IO_ERR, actual_brightness_event, NULL);
+    return TRUE;
+}
+
+// Watches the source brightness file, and the targets in bidirectional mode,
+// with inotify. Only sees writes made from userspace, so it is the fallback
+// when no kernel events are available.
+static gboolean watch_inotify(void) {
     // Initialize inotify
     inotify_fd = inotify_init();
     if (inotify_fd == -1) {
@@ -136,6 +421,13 @@ gboolean brightness_watch(duet_config_t *cfg) {
         return FALSE;
     }
     
+    for (guint i = 0; config->bidirectional && i < target_count; i++) {
+        if (inotify_add_watch(inotify_fd, config->target_displays[i], IN_MODIFY) == -1) {
+            g_printerr("Failed to add inotify watch for %s: %s\n",
+                       config->target_displays[i], g_strerror(errno));
+        }
+    }
+    
     // Create GIOChannel for inotify events
     inotify_channel = g_io_channel_unix_new(inotify_fd);
     if (!inotify_channel) {
@@ -150,26 +442,126 @@ gboolean brightness_watch(duet_config_t *cfg) {
     g_io_channel_set_close_on_unref(inotify_channel, TRUE);
     
     // Add watch for inotify events
-    g_io_add_watch(inotify_channel, G_IO_IN, inotify_event, NULL);
+    inotify_watch_id = g_io_add_watch(inotify_channel, G_IO_IN, inotify_event, NULL);
+    return TRUE;
+}
+
+gint brightness_get_percent(void) {
+    gint value = pending_brightness != -1 ? pending_brightness : last_brightness;
+    if (value == -1 || source_max <= 0) {
+        return -1;
+    }
+    return value * 100 / source_max;
+}
+
+void brightness_get_stats(brightness_stats_t *out) {
+    *out = stats;
+}
+
+gboolean brightness_watch(duet_config_t *cfg) {
+    // Get config from display module
+    config = cfg;
+    if (!config) {
+        g_printerr("No config available for brightness sync\n");
+        return FALSE;
+    }
+    
+    // Check if source file exists
+    if (!g_file_test(config->source_display, G_FILE_TEST_EXISTS)) {
+        g_printerr("Source brightness file does not exist: %s\n", config->source_display);
+        return FALSE;
+    }
+    
+    // Keep every file open so events don't pay for open/close
+    // Every panel is read and written in bidirectional mode
+    int source_flags = config->bidirectional ? O_RDWR : O_RDONLY;
+    int target_flags = config->bidirectional ? O_RDWR : O_WRONLY;
+    source_fd = open(config->source_display, source_flags | O_CLOEXEC);
+    if (source_fd == -1) {
+        g_printerr("Failed to open source brightness file: %s\n", g_strerror(errno));
+        return FALSE;
+    }
+    
+    target_count = g_strv_length(config->target_displays);
+    targets = g_new0(target_t, target_count);
+    for (guint i = 0; i < target_count; i++) {
+        targets[i].last = -1;
+        targets[i].fd = open(config->target_displays[i], target_flags | O_CLOEXEC);
+        if (targets[i].fd == -1) {
+            g_printerr("Failed to open target brightness file %s: %s\n",
+                       config->target_displays[i], g_strerror(errno));
+            target_count = i;
+            return FALSE;
+        }
+    }
+    build_maps();
+    
+    // Prefer kernel driven events, which also see hotkey and firmware changes.
+    // udev covers every panel; the other sources only stand in for it, as
+    // watching both would wake up and sync twice per change.
+    gboolean udev_events = watch_udev();
+    gboolean sysfs_events = !udev_events && watch_actual_brightness();
+    const gchar *method = udev_events    ? "udev events"
+                          : sysfs_events ? "sysfs events"
+                                         : "inotify";
+    // actual_brightness only covers the source, so target changes need
+    // inotify when udev is unavailable
+    gboolean need_inotify = !udev_events && (!sysfs_events || config->bidirectional);
+    if (need_inotify && !watch_inotify() && !sysfs_events) {
+        return FALSE;
+    }
     
     // Read initial brightness value
-    last_brightness = read_brightness();
-    if (last_brightness) {
-        g_print("Initial brightness: %s\n", last_brightness);
-        // Sync initial value
-        write_brightness(last_brightness);
+    last_brightness = read_brightness(source_fd, config->source_display);
+    if (last_brightness != -1) {
+        g_print("Initial brightness: %d\n", last_brightness);
+        // Sync initial value, the source wins at startup
+        pending_brightness = last_brightness;
+        pending_origin = ORIGIN_SOURCE;
+        flush_brightness();
     }
     
-    g_print("Brightness sync service started (using inotify)\n");
+    g_print("Brightness sync service started (using %s, %u target(s), max %d writes/s%s)\n",
+            method, target_count, config->max_writes_per_second,
+            config->bidirectional ? ", bidirectional" : "");
     return TRUE;
 }
 
 void brightness_cleanup(void) {
     g_print("Cleaning up brightness sync service\n");
     
+    // Don't lose a value still waiting for the rate limit
+    if (flush_id) {
+        g_source_remove(flush_id);
+        flush_id = 0;
+        flush_brightness();
+    }
+    
+    g_print("Brightness sync handled %" G_GUINT64_FORMAT " events in %" G_GUINT64_FORMAT
+            " wakeups with %" G_GUINT64_FORMAT " writes, %" G_GUINT64_FORMAT
+            " saved by rate limiting and %" G_GUINT64_FORMAT " echoes ignored\n",
+            stats.events, stats.syncs, stats.writes, stats.saved, stats.echoes);
+    
+    // Detach the watches before their fds close, so a reload never leaves a
+    // source polling a closed or reused fd
+    if (inotify_watch_id) {
+        g_source_remove(inotify_watch_id);
+        inotify_watch_id = 0;
+    }
+    if (actual_watch_id) {
+        g_source_remove(actual_watch_id);
+        actual_watch_id = 0;
+    }
+    if (udev_watch_id) {
+        g_source_remove(udev_watch_id);
+        udev_watch_id = 0;
+    }
+    
+    // The channel closes inotify_fd when it is unref'd
     if (inotify_channel) {
         g_io_channel_unref(inotify_channel);
         inotify_channel = NULL;
+        inotify_fd = -1;
     }
     
     if (inotify_fd != -1) {
@@ -177,11 +569,66 @@ void brightness_cleanup(void) {
         inotify_fd = -1;
     }
     
-    if (target_fd != -1) {
-        close(target_fd);
-        target_fd = -1;
+    if (actual_channel) {
+        g_io_channel_unref(actual_channel);
+        actual_channel = NULL;
     }
     
-    g_free(last_brightness);
-    last_brightness = NULL;
+    if (udev_channel) {
+        g_io_channel_unref(udev_channel);
+        udev_channel = NULL;
+    }
+    
+    if (udev_monitor) {
+        udev_monitor_unref(udev_monitor);
+        udev_monitor = NULL;
+    }
+    
+    if (udev_ctx) {
+        udev_unref(udev_ctx);
+        udev_ctx = NULL;
+    }
+    
+    g_free(source_sysname);
+    source_sysname = NULL;
+    
+    if (source_fd != -1) {
+        close(source_fd);
+        source_fd = -1;
+    }
+    
+    free_maps();
+    for (guint i = 0; i < target_count; i++) {
+        close(targets[i].fd);
+        g_free(targets[i].sysname);
+    }
+    g_free(targets);
+    targets = NULL;
+    target_count = 0;
+    source_max = -1;
+    
+    last_brightness = -1;
+}
+
+gboolean brightness_reload(duet_config_t *cfg) {
+    if (source_fd == -1) {
+        return brightness_watch(cfg);
+    }
+    
+    // Restart if the panels or sync direction changed, otherwise just rebuild the tables
+    if (g_strcmp0(cfg->source_display, config->source_display) != 0 ||
+        cfg->bidirectional != config->bidirectional ||
+        !g_strv_equal((const gchar *const *)cfg->target_displays,
+                      (const gchar *const *)config->target_displays)) {
+        brightness_cleanup();
+        return brightness_watch(cfg);
+    }
+    
+    config = cfg;
+    build_maps();
+    
+    // Write the current value again with the new mapping
+    last_brightness = -1;
+    sync_brightness(0);
+    return TRUE;
 }
@@ -3,9 +3,32 @@
 #include <glib.h>
 #include "config.h"
 
+typedef struct {
+    // Change notifications received from inotify, udev and sysfs
+    guint64 events;
+    // Wakeups that read the source brightness
+    guint64 syncs;
+    // Writes made to the targets
+    guint64 writes;
+    // Target writes skipped because a newer value arrived within the rate limit
+    guint64 saved;
+    // Bidirectional wakeups where no panel changed, e.g. echoes of our own writes
+    guint64 echoes;
+} brightness_stats_t;
+
 // Initialize brightness sync service
 // Returns TRUE on success, FALSE on failure
 gboolean brightness_watch(duet_config_t *cfg);
 
+// Apply a reloaded config: rebuilds the brightness mapping, restarting the
+// service if the source or target panels changed
+gboolean brightness_reload(duet_config_t *cfg);
+
+// Get the source brightness as a percentage of its maximum, or -1 if unknown
+gint brightness_get_percent(void);
+
+// Get the brightness sync counters
+void brightness_get_stats(brightness_stats_t *stats);
+
 // Cleanup brightness sync service
 void brightness_cleanup(void);
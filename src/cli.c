@@ -22,11 +22,19 @@ static char doc[] = "Duet -- A utility for managing dual-screen setups on the "
                     "  mirror       (1) - Mirror displays\n"
                     "  landscape    (2) - Landscape orientation\n"
                     "  portrait-90  (3) - Portrait 90° rotation\n"
-                    "  portrait-270 (4) - Portrait 270° rotation";
+                    "  portrait-270 (4) - Portrait 270° rotation\n"
+                    "\n"
+                    "duet monitor prints the keyboard, rotation, mode, layout "
+                    "and brightness state, then a line for each change, e.g. "
+                    "for a status bar.\n"
+                    "\n"
+                    "duet trace prints the daemon's recent event latency "
+                    "trace as Chrome trace JSON, for chrome://tracing or "
+                    "Perfetto.";
 
 /* Argument description with mode options */
 static char args_doc[] =
-    "MODE (auto|mirror|landscape|portrait-90|portrait-270|0-4)";
+    "MODE (auto|mirror|landscape|portrait-90|portrait-270|0-4)\nmonitor\ntrace";
 
 /* Options (none) */
 static struct argp_option options[] = {{0}};
@@ -42,6 +50,8 @@ static const struct mode_mapping modes[] = {
 
 struct arguments {
   int mode;
+  int monitor;
+  int trace;
 };
 
 static error_t parse_opt(int key, char *arg, struct argp_state *state) {
@@ -52,6 +62,15 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
     if (state->arg_num >= 1)
       argp_usage(state);
 
+    if (strcmp(arg, "monitor") == 0) {
+      arguments->monitor = 1;
+      return 0;
+    }
+    if (strcmp(arg, "trace") == 0) {
+      arguments->trace = 1;
+      return 0;
+    }
+
     /* Try to match mode names */
     for (int i = 0; modes[i].name != NULL; i++) {
       if (strcmp(arg, modes[i].name) == 0) {
@@ -87,14 +106,12 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
 
 static struct argp argp = {options, parse_opt, args_doc, doc};
 
-void send_event(char *event, char *payload) {
-  int sockfd = -1;
+/* How long to wait for the layout to be applied */
+#define REPLY_TIMEOUT_S 30
 
-  /* Validate input parameters */
-  if (!event || !payload) {
-    fprintf(stderr, "Error: event or payload cannot be NULL\n");
-    return;
-  }
+/* Connects to the duetd command socket, returning the fd or -1 */
+static int connect_daemon(void) {
+  int sockfd;
 
   /* Get runtime directory from environment */
   char *runtime_dir = getenv("XDG_RUNTIME_DIR");
@@ -106,7 +123,7 @@ void send_event(char *event, char *payload) {
         "  1. The program is running as root instead of a user session\n"
         "  2. The environment is not properly configured\n"
         "Try running as your regular user account (not with sudo)");
-    return;
+    return -1;
   }
 
   /* Create socket path */
@@ -115,13 +132,13 @@ void send_event(char *event, char *payload) {
                           "%s/duet/cmd.socket", runtime_dir);
   if (path_len < 0 || (size_t)path_len >= sizeof(socket_path)) {
     fprintf(stderr, "Error: Socket path too long\n");
-    return;
+    return -1;
   }
 
   /* Create UNIX socket */
   if ((sockfd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
     perror("socket");
-    return;
+    return -1;
   }
 
   /* Configure socket address */
@@ -139,12 +156,31 @@ void send_event(char *event, char *payload) {
                  "  1. The duetd daemon is not running\n"
                  "  2. The user doesn't have permission to access the socket\n"
                  "Make sure duetd is started in your Hyprland config.");
-    goto cleanup;
+    close(sockfd);
+    return -1;
+  }
+
+  return sockfd;
+}
+
+/* Sends an event and returns the exit status for the daemon's reply */
+int send_event(char *event, char *payload) {
+  int sockfd = -1;
+  int status = EXIT_SUCCESS;
+  char *message = NULL;
+
+  /* Validate input parameters */
+  if (!event || !payload) {
+    fprintf(stderr, "Error: event or payload cannot be NULL\n");
+    return EXIT_FAILURE;
   }
 
+  if ((sockfd = connect_daemon()) == -1)
+    return EXIT_FAILURE;
+
   /* Format message with newline */
   size_t msg_len = strlen(event) + strlen(payload) + 3;
-  char *message = malloc(msg_len);
+  message = malloc(msg_len);
   snprintf(message, msg_len, "%s:%s\n", event, payload);
 
   /* Full write with flush behavior */
@@ -170,27 +206,116 @@ void send_event(char *event, char *payload) {
           "Socket shutdown failed. Server might not have received EOF");
   }
 
-  /* Non-blocking read to drain response (if any) */
-  struct timeval tv = {.tv_sec = 0, .tv_usec = 1000 };  // 1 ms timeout
+  /* Wait for the reply, sent once the resulting layout is applied */
+  struct timeval tv = {.tv_sec = REPLY_TIMEOUT_S, .tv_usec = 0};
   setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
 
-  char buf[128];
-  while (recv(sockfd, buf, sizeof(buf), 0) > 0) {
-      // Drain any unexpected response
+  char reply[256];
+  size_t reply_len = 0;
+  while (reply_len < sizeof(reply) - 1) {
+    ssize_t received =
+        recv(sockfd, reply + reply_len, sizeof(reply) - 1 - reply_len, 0);
+    if (received <= 0)
+      break;
+    reply_len += received;
+    if (memchr(reply, '\n', reply_len))
+      break;
+  }
+  reply[reply_len] = '\0';
+  reply[strcspn(reply, "\n")] = '\0';
+
+  char layout[64];
+  double latency;
+  if (sscanf(reply, "ok %63s %lf", layout, &latency) == 2) {
+    printf("Applied %s layout in %.1f ms\n", layout, latency);
+  } else if (strncmp(reply, "error ", 6) == 0) {
+    fprintf(stderr, "duetd: %s\n", reply + 6);
+    status = EXIT_FAILURE;
+  } else {
+    fprintf(stderr, "No reply from duetd within %d s\n", REPLY_TIMEOUT_S);
+    status = EXIT_FAILURE;
   }
 
-cleanup:
   free(message);
   if (sockfd != -1)
     close(sockfd);
+  return status;
+}
+
+/* Prints state lines from the daemon until it closes the connection */
+static int monitor_state(void) {
+  int sockfd = connect_daemon();
+  if (sockfd == -1)
+    return EXIT_FAILURE;
+
+  /* The subscription lasts while our side of the connection stays open */
+  const char request[] = "subscribe\n";
+  if (send(sockfd, request, sizeof(request) - 1, MSG_NOSIGNAL) == -1) {
+    perror("send");
+    close(sockfd);
+    return EXIT_FAILURE;
+  }
+
+  FILE *stream = fdopen(sockfd, "r");
+  char *line = NULL;
+  size_t size = 0;
+  while (getline(&line, &size, stream) != -1) {
+    if (strncmp(line, "state ", 6) == 0) {
+      fputs(line + 6, stdout);
+      fflush(stdout);
+    } else if (strncmp(line, "error ", 6) == 0) {
+      fprintf(stderr, "duetd: %s", line + 6);
+    }
+  }
+  free(line);
+  fclose(stream);
+
+  fprintf(stderr, "duetd closed the connection\n");
+  return EXIT_FAILURE;
+}
+
+/* Prints the daemon's trace buffer as JSON */
+static int dump_trace(void) {
+  int sockfd = connect_daemon();
+  if (sockfd == -1)
+    return EXIT_FAILURE;
+
+  const char request[] = "trace\n";
+  if (send(sockfd, request, sizeof(request) - 1, MSG_NOSIGNAL) == -1) {
+    perror("send");
+    close(sockfd);
+    return EXIT_FAILURE;
+  }
+  shutdown(sockfd, SHUT_WR);
+
+  struct timeval tv = {.tv_sec = REPLY_TIMEOUT_S, .tv_usec = 0};
+  setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+  FILE *stream = fdopen(sockfd, "r");
+  char *line = NULL;
+  size_t size = 0;
+  int status = EXIT_FAILURE;
+  if (getline(&line, &size, stream) != -1 &&
+      strncmp(line, "trace ", 6) == 0) {
+    fputs(line + 6, stdout);
+    status = EXIT_SUCCESS;
+  } else {
+    fprintf(stderr, "No trace from duetd\n");
+  }
+  free(line);
+  fclose(stream);
+  return status;
 }
 
 int main(int argc, char **argv) {
   struct arguments arguments = {0};
   argp_parse(&argp, argc, argv, 0, 0, &arguments);
 
-  char mode = arguments.mode + '0';
-  send_event("mode", &mode);
+  if (arguments.monitor)
+    return monitor_state();
+  if (arguments.trace)
+    return dump_trace();
 
-  return 0;
+  char mode[] = {arguments.mode + '0', '\0'};
+  return send_event("mode", mode);
 }
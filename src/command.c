@@ -9,81 +9,448 @@
 #include <sys/un.h>
 #include <unistd.h>
 
+#include "brightness.h"
 #include "command.h"
 #include "display.h"
+#include "trace.h"
 
 static int server_fd = -1;
 static char socket_path[1024];
 static GIOChannel *server_channel = NULL;
+static guint server_watch_id = 0;
+// Set once the listening socket was handed to a newer duetd, which then
+// owns the socket file
+static gboolean handed_off = FALSE;
 
-static void mode_switch(duet_context_t *context, char *payload) {
-  int mode = atoi(payload);
-  printf("Received mode switch: %d, old mode: %d\n", mode, context->mode);
-  context->mode = mode;
-  setLayout(context);
+// Longest request line accepted, including the newline
+#define MAX_LINE 1024
+// Requests a client may have waiting for replies before it is read no further
+#define MAX_PENDING 16
+// Unwritten bytes after which a subscriber counts as stalled and is dropped
+#define MAX_SUBSCRIBER_BACKLOG 4096
+
+static const duet_config_t *config = NULL;
+static duet_context_t *server_context = NULL;
+// Every connected client
+static GHashTable *clients = NULL;
+// Whether connections wait in the backlog because of MAX_CLIENTS
+static gboolean deferring = FALSE;
+static guint clients_served = 0;
+static guint limit_reached = 0;
+static guint clients_timed_out = 0;
+static guint subscribers_dropped = 0;
+// The state line last sent to subscribers
+static gchar *published_state = NULL;
+// Called once every client is answered and flushed, see command_when_drained()
+static GSourceFunc drained_func = NULL;
+static gpointer drained_data = NULL;
+
+// A connected client. Requests are newline terminated "event:payload" lines
+// and may be pipelined; each gets a one line reply, in order, once the layout
+// it leads to is applied.
+typedef struct {
+  GIOChannel *channel;
+  /** Read watch, removed while the client is throttled or once it is closed */
+  guint read_id;
+  /** Write watch while replies wait for the socket to drain, otherwise 0 */
+  guint write_id;
+  /** Idle timeout while nothing is in flight, otherwise 0 */
+  guint idle_id;
+  /** Bytes received but not yet parsed, at most a read plus MAX_LINE */
+  GString *input;
+  /** Replies not yet written */
+  GString *output;
+  /** Skipping the rest of a line that exceeded MAX_LINE */
+  gboolean discarding;
+  /** Requests waiting for their reply */
+  guint pending;
+  /** Whether the client closed its side */
+  gboolean eof;
+  /** Whether the client is being disconnected; replies are discarded */
+  gboolean dropped;
+  /** Whether state changes are pushed to the client */
+  gboolean subscribed;
+  /**
+   * Whether parse_input() is running for the client. Replies can be sent
+   * from within it, as display_when_idle() answers right away when idle;
+   * parsing and freeing are then left to the outer caller.
+   */
+  gboolean parsing;
+} client_t;
+
+typedef struct {
+  client_t *client;
+  /** Monotonic time the request was parsed */
+  gint64 start;
+  /** Reply with this error instead of the layout, or NULL */
+  gchar *error;
+  /** Subscribe the client to state changes instead of replying */
+  gboolean subscribe;
+  /** Reply with the trace buffer instead of the layout */
+  gboolean trace;
+  /** The input event the request was traced as, 0 if none */
+  guint trace_id;
+} request_t;
+
+static gboolean server_conn_cb(GIOChannel *source, GIOCondition condition,
+                               gpointer data);
+static gboolean client_data_cb(GIOChannel *source, GIOCondition condition,
+                               gpointer data);
+static void parse_input(client_t *client);
+
+// Accepts connections only while there is room for another client. Otherwise
+// they wait in the listen backlog.
+static void update_accepting(void) {
+  gboolean accept = server_channel && !handed_off &&
+                    g_hash_table_size(clients) < (guint)config->max_clients;
+  if (accept && !server_watch_id) {
+    server_watch_id =
+        g_io_add_watch(server_channel, G_IO_IN, server_conn_cb, NULL);
+  } else if (!accept && server_watch_id) {
+    g_source_remove(server_watch_id);
+    server_watch_id = 0;
+  }
+
+  if (!accept && !handed_off && !deferring) {
+    limit_reached++;
+    g_print("Command client limit of %d reached, deferring connections\n",
+            config->max_clients);
+  }
+  deferring = !accept && !handed_off;
 }
 
-static void message_received(duet_context_t *context, const char *event,
-                             size_t len) {
-  // Split first colon, before is event type, after is the payload.
-  char *payload = strchr(event, ':');
-  if (payload == NULL) {
+static void client_free(client_t *client) {
+  if (client->read_id) {
+    g_source_remove(client->read_id);
+  }
+  if (client->write_id) {
+    g_source_remove(client->write_id);
+  }
+  if (client->idle_id) {
+    g_source_remove(client->idle_id);
+  }
+  g_io_channel_unref(client->channel);
+  g_string_free(client->input, TRUE);
+  g_string_free(client->output, TRUE);
+  g_free(client);
+}
+
+// Calls the drained waiter once every client is gone, except subscribers
+// with no reply left to send. A client whose request is still unread in its
+// socket stays until it closed its side and was answered, or timed out idle.
+static void check_drained(void) {
+  if (!drained_func) {
+    return;
+  }
+  if (clients) {
+    GHashTableIter iter;
+    gpointer key;
+    g_hash_table_iter_init(&iter, clients);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+      client_t *client = key;
+      if (!client->subscribed || client->pending || client->write_id) {
+        return;
+      }
+    }
+  }
+  GSourceFunc func = drained_func;
+  drained_func = NULL;
+  func(drained_data);
+}
+
+// Frees the client once it is closed, answered and flushed
+static void client_maybe_free(client_t *client) {
+  if (client->parsing) {
+    return;
+  }
+  if ((client->eof || client->dropped) && !client->write_id &&
+      !client->pending) {
+    g_hash_table_remove(clients, client);
+    client_free(client);
+    update_accepting();
+  }
+  check_drained();
+}
+
+// Disconnects the client, discarding its unwritten replies. It is freed once
+// its pending requests are done.
+static void client_drop(client_t *client) {
+  client->dropped = TRUE;
+  g_string_truncate(client->output, 0);
+  if (client->read_id) {
+    g_source_remove(client->read_id);
+    client->read_id = 0;
+  }
+  if (client->write_id) {
+    g_source_remove(client->write_id);
+    client->write_id = 0;
+  }
+  if (client->idle_id) {
+    g_source_remove(client->idle_id);
+    client->idle_id = 0;
+  }
+  client_maybe_free(client);
+}
+
+static gboolean client_idle(gpointer data) {
+  client_t *client = data;
+  client->idle_id = 0;
+  clients_timed_out++;
+  g_print("Disconnecting idle command client\n");
+  client_drop(client);
+  return G_SOURCE_REMOVE;
+}
+
+// Reads only while the client is within its limits, so a client sending
+// faster than its requests are answered blocks in send() instead of growing
+// the daemon's buffers. Restarts the idle timeout once nothing is in flight;
+// subscribers are never idle.
+static void update_client(client_t *client) {
+  gboolean busy = client->pending > 0 || client->write_id || client->subscribed;
+  gboolean read = !client->eof && !client->dropped &&
+                  client->pending < MAX_PENDING && !client->write_id;
+  if (read && !client->read_id) {
+    client->read_id = g_io_add_watch(client->channel, G_IO_IN | G_IO_HUP,
+                                     client_data_cb, client);
+  } else if (!read && client->read_id) {
+    g_source_remove(client->read_id);
+    client->read_id = 0;
+  }
+
+  if (client->idle_id) {
+    g_source_remove(client->idle_id);
+    client->idle_id = 0;
+  }
+  if (!busy && !client->eof && !client->dropped &&
+      config->client_idle_timeout_ms > 0) {
+    client->idle_id =
+        g_timeout_add(config->client_idle_timeout_ms, client_idle, client);
+  }
+}
+
+static gboolean client_flush(client_t *client) {
+  int fd = g_io_channel_unix_get_fd(client->channel);
+  while (client->output->len > 0) {
+    ssize_t sent = send(fd, client->output->str, client->output->len,
+                        MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (sent == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN) {
+        return FALSE;
+      }
+      // The client is gone, nobody is left to read the replies
+      client->dropped = TRUE;
+      g_string_truncate(client->output, 0);
+      break;
+    }
+    g_string_erase(client->output, 0, sent);
+  }
+  return TRUE;
+}
+
+static gboolean client_writable(GIOChannel *source, GIOCondition condition,
+                                gpointer data) {
+  client_t *client = data;
+  if (!client_flush(client)) {
+    return G_SOURCE_CONTINUE;
+  }
+  client->write_id = 0;
+  parse_input(client);
+  client_maybe_free(client);
+  return G_SOURCE_REMOVE;
+}
+
+static void client_reply(client_t *client, const gchar *reply) {
+  if (client->dropped) {
     return;
   }
-  *payload = '\0';
-  ++payload;
-  // If last char is new line, remove it.
-  char *last = payload + strlen(payload) - 1;
-  if (*last == '\n') {
-    *last = '\0';
+  g_string_append(client->output, reply);
+  if (!client->write_id && !client_flush(client)) {
+    client->write_id = g_io_add_watch(client->channel, G_IO_OUT | G_IO_ERR,
+                                      client_writable, client);
   }
+}
+
+// Formats the state pushed to subscribers as one line
+static gchar *format_state(void) {
+  GString *line = g_string_new(NULL);
+  g_string_append_printf(line,
+                         "state keyboard=%s rotation=%s mode=%s layout=%s",
+                         server_context->keyboardConnected ? "attached"
+                                                           : "detached",
+                         rotation_name(server_context->rotation),
+                         mode_name(server_context->mode),
+                         display_layout_name(display_get_applied_layout()));
+  gint brightness = brightness_get_percent();
+  if (brightness != -1) {
+    g_string_append_printf(line, " brightness=%d", brightness);
+  }
+  g_string_append_c(line, '\n');
+  return g_string_free(line, FALSE);
+}
 
-  if (g_str_equal(event, "mode")) {
-    mode_switch(context, payload);
+static void request_done(int layout, gpointer data) {
+  request_t *request = data;
+  client_t *client = request->client;
+
+  gchar *reply;
+  if (request->subscribe && !request->error) {
+    client->subscribed = TRUE;
+    reply = format_state();
+  } else if (request->trace) {
+    gchar *json = trace_dump_json();
+    reply = g_strdup_printf("trace %s\n", json);
+    g_free(json);
+  } else if (request->error) {
+    reply = g_strdup_printf("error %s\n", request->error);
+  } else if (layout == -1) {
+    reply = g_strdup("error layout not applied\n");
   } else {
-    printf("Unknown event: %s\n", event);
+    reply = g_strdup_printf("ok %s %.1f\n", display_layout_name(layout),
+                            (g_get_monotonic_time() - request->start) /
+                                1000.0);
   }
+  client_reply(client, reply);
+  g_free(reply);
+  trace_stage(request->trace_id, "command reply", request->start,
+              g_get_monotonic_time());
+  g_free(request->error);
+  g_free(request);
+
+  client->pending--;
+  parse_input(client);
+  client_maybe_free(client);
 }
 
-// Client connection callback
-static gboolean client_data_cb(GIOChannel *source, GIOCondition condition,
-                               gpointer data) {
-  duet_context_t *context = (duet_context_t *)data;
+static gchar *mode_switch(duet_context_t *context, const char *payload,
+                          guint trace_id) {
+  char *end;
+  long mode = strtol(payload, &end, 10);
+  if (end == payload || *end != '\0' || mode < MODE_AUTO ||
+      mode > MODE_PORTRAIT_270) {
+    return g_strdup_printf("invalid mode %s", payload);
+  }
+  printf("Received mode switch: %ld, old mode: %d\n", mode, context->mode);
+  context->mode = mode;
+  display_schedule_layout(context, TRUE, trace_id);
+  return NULL;
+}
+
+static request_t *request_new(client_t *client) {
+  request_t *request = g_new0(request_t, 1);
+  request->client = client;
+  request->start = g_get_monotonic_time();
+  return request;
+}
+
+// The reply waits for any layout update the request started, and for those of
+// earlier requests, to finish
+static void request_queue(request_t *request) {
+  request->client->pending++;
+  display_when_idle(request_done, request);
+}
 
-  if (condition & G_IO_HUP) {
-    // Client disconnected
-    g_io_channel_shutdown(source, TRUE, NULL);
-    g_io_channel_unref(source);
-    return G_SOURCE_REMOVE; // Remove the source
+// Handles one request line
+static void request_received(client_t *client, gchar *line) {
+  request_t *request = request_new(client);
+
+  // Split first colon, before is event type, after is the payload.
+  char *payload = strchr(line, ':');
+  if (payload == NULL) {
+    payload = "";
+  } else {
+    *payload++ = '\0';
   }
 
-  if (condition & G_IO_IN) {
-    char buffer[4096];
-    gsize bytes_read;
-    GError *error = NULL;
-
-    GIOStatus status = g_io_channel_read_chars(source, buffer, sizeof(buffer),
-                                               &bytes_read, &error);
-    if (status == G_IO_STATUS_ERROR) {
-      g_error_free(error);
-      g_io_channel_shutdown(source, TRUE, NULL);
-      g_io_channel_unref(source);
-      return G_SOURCE_REMOVE;
+  if (g_str_equal(line, "mode")) {
+    request->trace_id = trace_event("command");
+    request->error = mode_switch(server_context, payload, request->trace_id);
+  } else if (g_str_equal(line, "subscribe")) {
+    request->subscribe = TRUE;
+  } else if (g_str_equal(line, "trace")) {
+    request->trace = TRUE;
+  } else {
+    printf("Unknown event: %s\n", line);
+    request->error = g_strdup_printf("unknown event %s", line);
+  }
+
+  request_queue(request);
+}
+
+// Handles buffered request lines while the client is within its limits
+static void parse_input(client_t *client) {
+  if (client->parsing) {
+    return;
+  }
+  client->parsing = TRUE;
+  while (!client->dropped && client->pending < MAX_PENDING &&
+         client->input->len > 0) {
+    char *newline = memchr(client->input->str, '\n', client->input->len);
+    gsize length = newline ? (gsize)(newline - client->input->str)
+                           : client->input->len;
+
+    // An overlong line is answered once and its remainder skipped
+    if (length >= MAX_LINE) {
+      if (!client->discarding) {
+        request_t *request = request_new(client);
+        request->error = g_strdup("line too long");
+        request_queue(request);
+      }
+      client->discarding = !newline;
+      g_string_erase(client->input, 0, newline ? length + 1 : length);
+      continue;
+    }
+    if (!newline) {
+      break;
     }
 
-    if (bytes_read > 0) {
-      message_received(context, buffer, bytes_read);
+    *newline = '\0';
+    if (length > 0 && newline[-1] == '\r') {
+      newline[-1] = '\0';
     }
+    if (client->discarding) {
+      client->discarding = FALSE;
+    } else {
+      request_received(client, client->input->str);
+    }
+    g_string_erase(client->input, 0, length + 1);
   }
+  client->parsing = FALSE;
+  update_client(client);
+}
 
-  return G_SOURCE_CONTINUE;
+// Client connection callback
+static gboolean client_data_cb(GIOChannel *source, GIOCondition condition,
+                               gpointer data) {
+  client_t *client = data;
+  char buffer[4096];
+  ssize_t received = recv(g_io_channel_unix_get_fd(source), buffer,
+                          sizeof(buffer), MSG_DONTWAIT);
+  if (received == -1 && (errno == EINTR || errno == EAGAIN)) {
+    return G_SOURCE_CONTINUE;
+  }
+
+  if (received > 0) {
+    g_string_append_len(client->input, buffer, received);
+  } else {
+    // The client closed its side; a last line without newline still counts
+    client->eof = TRUE;
+    if (client->input->len > 0 && !client->discarding) {
+      g_string_append_c(client->input, '\n');
+    }
+  }
+  // update_client() removes the watch once the client is throttled or closed
+  parse_input(client);
+  gboolean reading = client->read_id != 0;
+  client_maybe_free(client);
+  return reading ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
 }
 
 // Server callback to accept new connections
 static gboolean server_conn_cb(GIOChannel *source, GIOCondition condition,
                                gpointer data) {
-  duet_context_t *context = (duet_context_t *)data;
-
   if (condition & G_IO_IN) {
     int client_fd = accept(g_io_channel_unix_get_fd(source), NULL, NULL);
     if (client_fd == -1) {
@@ -91,57 +458,88 @@ static gboolean server_conn_cb(GIOChannel *source, GIOCondition condition,
       return G_SOURCE_CONTINUE;
     }
 
-    // Set client socket to non-blocking
+    // Set client socket to non-blocking, and keep it from spawned commands
     int flags = fcntl(client_fd, F_GETFL, 0);
-    if (flags == -1 || fcntl(client_fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+    if (flags == -1 || fcntl(client_fd, F_SETFL, flags | O_NONBLOCK) == -1 ||
+        fcntl(client_fd, F_SETFD, FD_CLOEXEC) == -1) {
       perror("fcntl");
       close(client_fd);
       return G_SOURCE_CONTINUE;
     }
 
-    GIOChannel *client_channel = g_io_channel_unix_new(client_fd);
-    g_io_channel_set_encoding(client_channel, NULL, NULL);
-    g_io_channel_set_close_on_unref(client_channel, TRUE);
+    client_t *client = g_new0(client_t, 1);
+    client->input = g_string_new(NULL);
+    client->output = g_string_new(NULL);
+    client->channel = g_io_channel_unix_new(client_fd);
+    g_io_channel_set_encoding(client->channel, NULL, NULL);
+    g_io_channel_set_close_on_unref(client->channel, TRUE);
+    g_hash_table_add(clients, client);
+    clients_served++;
 
     // Watch for client data and hangups
-    g_io_add_watch(client_channel, G_IO_IN | G_IO_HUP, client_data_cb, context);
+    update_client(client);
   }
 
+  // Stop accepting until a client is freed
+  if (g_hash_table_size(clients) >= (guint)config->max_clients) {
+    server_watch_id = 0;
+    update_accepting();
+    return G_SOURCE_REMOVE;
+  }
   return G_SOURCE_CONTINUE;
 }
 
-void command_watch(duet_context_t *context) {
-  const char *runtime_dir = g_getenv("XDG_RUNTIME_DIR");
-  if (!runtime_dir) {
-    g_printerr("XDG_RUNTIME_DIR is not set\n");
+void command_publish_state(void) {
+  if (!clients || !server_context) {
     return;
   }
-
-  // Build full socket path in one step
-  int path_len = snprintf(socket_path, sizeof(socket_path),
-                          "%s/duet/cmd.socket", runtime_dir);
-
-  // Check for truncation
-  if (path_len < 0) {
-    perror("snprintf");
-    return;
-  } else if (path_len >= sizeof(socket_path)) {
-    g_printerr("Socket path exceeds buffer size\n");
+  gchar *line = format_state();
+  if (g_strcmp0(line, published_state) == 0) {
+    g_free(line);
     return;
   }
+  g_free(published_state);
+  published_state = line;
 
+  // Never wait for a subscriber: one whose replies are backing up is dropped
+  // instead. Dropping frees clients, so it happens after the iteration.
+  GSList *stalled = NULL;
+  GHashTableIter iter;
+  gpointer key;
+  g_hash_table_iter_init(&iter, clients);
+  while (g_hash_table_iter_next(&iter, &key, NULL)) {
+    client_t *client = key;
+    if (!client->subscribed || client->dropped) {
+      continue;
+    }
+    if (client->output->len + strlen(line) > MAX_SUBSCRIBER_BACKLOG) {
+      stalled = g_slist_prepend(stalled, client);
+    } else {
+      client_reply(client, line);
+    }
+  }
+  for (GSList *l = stalled; l; l = l->next) {
+    subscribers_dropped++;
+    g_print("Dropping stalled state subscriber\n");
+    client_drop(l->data);
+  }
+  g_slist_free(stalled);
+}
+
+// Creates the listening socket at socket_path, replacing any stale one
+static int create_server_socket(void) {
   // Extract directory part using GLib
   gchar *dir_path = g_path_get_dirname(socket_path);
   if (!dir_path) {
     g_printerr("Failed to parse directory\n");
-    return;
+    return -1;
   }
 
   // Create directory (with proper permissions)
   if (mkdir(dir_path, 0700) == -1 && errno != EEXIST) {
     perror("mkdir");
     g_free(dir_path);
-    return;
+    return -1;
   }
   g_free(dir_path);
 
@@ -149,9 +547,10 @@ void command_watch(duet_context_t *context) {
   unlink(socket_path);
 
   // Create socket
-  if ((server_fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+  int fd;
+  if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) {
     perror("socket");
-    return;
+    return -1;
   }
 
   // Bind socket
@@ -159,16 +558,51 @@ void command_watch(duet_context_t *context) {
   addr.sun_family = AF_UNIX;
   strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
 
-  if (bind(server_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
     perror("bind");
-    close(server_fd);
-    return;
+    close(fd);
+    return -1;
   }
 
   // Listen
-  if (listen(server_fd, SOMAXCONN) == -1) {
+  if (listen(fd, SOMAXCONN) == -1) {
     perror("listen");
-    close(server_fd);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+void command_watch(duet_context_t *context, const duet_config_t *cfg,
+                   int listen_fd) {
+  server_context = context;
+  config = cfg;
+  clients = g_hash_table_new(NULL, NULL);
+
+  const char *runtime_dir = g_getenv("XDG_RUNTIME_DIR");
+  if (!runtime_dir) {
+    g_printerr("XDG_RUNTIME_DIR is not set\n");
+    return;
+  }
+
+  // Build full socket path in one step
+  int path_len = snprintf(socket_path, sizeof(socket_path),
+                          "%s/duet/cmd.socket", runtime_dir);
+
+  // Check for truncation
+  if (path_len < 0) {
+    perror("snprintf");
+    return;
+  } else if (path_len >= sizeof(socket_path)) {
+    g_printerr("Socket path exceeds buffer size\n");
+    return;
+  }
+
+  // A socket handed over by a previous duetd keeps its queued connections
+  if (listen_fd != -1) {
+    server_fd = listen_fd;
+    g_print("Adopted command socket from previous duetd\n");
+  } else if ((server_fd = create_server_socket()) == -1) {
     return;
   }
 
@@ -177,6 +611,7 @@ void command_watch(duet_context_t *context) {
   if (flags == -1 || fcntl(server_fd, F_SETFL, flags | O_NONBLOCK) == -1) {
     perror("fcntl");
     close(server_fd);
+    server_fd = -1;
     return;
   }
 
@@ -184,12 +619,53 @@ void command_watch(duet_context_t *context) {
   server_channel = g_io_channel_unix_new(server_fd);
   g_io_channel_set_encoding(server_channel, NULL, NULL);
   g_io_channel_set_close_on_unref(server_channel, TRUE);
-  g_io_add_watch(server_channel, G_IO_IN, server_conn_cb, context);
+  update_accepting();
+}
+
+int command_handoff(void) {
+  if (!server_channel) {
+    return -1;
+  }
+  handed_off = TRUE;
+  update_accepting();
+  g_io_channel_set_close_on_unref(server_channel, FALSE);
+  return server_fd;
+}
+
+void command_when_drained(GSourceFunc func, gpointer data) {
+  drained_func = func;
+  drained_data = data;
+  check_drained();
 }
 
 void command_cleanup() {
   printf("Cleaning up commands\n");
+  g_print("Command socket: %u clients served, client limit reached %u "
+          "times, %u idle clients disconnected, %u stalled subscribers "
+          "dropped\n",
+          clients_served, limit_reached, clients_timed_out,
+          subscribers_dropped);
+  g_clear_pointer(&published_state, g_free);
 
-  g_io_channel_unref(server_channel);
-  unlink(socket_path);
+  // Requests still waiting are never answered once the main loop stopped
+  if (clients) {
+    GHashTableIter iter;
+    gpointer client;
+    g_hash_table_iter_init(&iter, clients);
+    while (g_hash_table_iter_next(&iter, &client, NULL)) {
+      client_free(client);
+    }
+    g_hash_table_destroy(clients);
+    clients = NULL;
+  }
+  if (server_watch_id) {
+    g_source_remove(server_watch_id);
+    server_watch_id = 0;
+  }
+  if (server_channel) {
+    g_io_channel_unref(server_channel);
+  }
+  if (!handed_off) {
+    unlink(socket_path);
+  }
 }
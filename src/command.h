@@ -1,6 +1,40 @@
 #pragma once
 
+#include <glib.h>
+
+#include "config.h"
 #include "context.h"
 
-void command_watch(duet_context_t *context);
+/**
+ * Starts accepting commands on $XDG_RUNTIME_DIR/duet/cmd.socket.
+ * At most MAX_CLIENTS clients are served at once and idle ones are
+ * disconnected after IDLE_TIMEOUT_MS.
+ * @param listen_fd A listening socket handed over by a previous duetd, or -1
+ * to create the socket.
+ */
+void command_watch(duet_context_t *context, const duet_config_t *config,
+                   int listen_fd);
+
+/**
+ * Stops accepting connections so the listening socket can be handed to a
+ * newer duetd. The socket file is then left in place on cleanup.
+ * @return The listening socket, or -1 if there is none.
+ */
+int command_handoff(void);
+
+/**
+ * Calls func with data once every client has closed its side and had its
+ * requests answered and written, or was disconnected as idle. Subscribers
+ * only need to have no reply left to write. Called right away if there are
+ * no such clients; only one call is pending at a time.
+ */
+void command_when_drained(GSourceFunc func, gpointer data);
+
+/**
+ * Pushes the keyboard, rotation, mode, applied layout and brightness state to
+ * clients that sent `subscribe`, if it changed since the last push. Never
+ * blocks; subscribers that stop reading are disconnected.
+ */
+void command_publish_state(void);
+
 void command_cleanup();
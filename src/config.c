@@ -1,8 +1,14 @@
 // Configuration loader using GLib GKeyFile
 #include "config.h"
 
+#include <string.h>
+
 #define GROUP_BRIGHTNESS "Brightness Sync"
 #define GROUP_LAYOUT "Layout Commands"
+#define GROUP_DISPLAY "Display"
+#define GROUP_ROTATION "Rotation"
+#define GROUP_KEYBOARD "Keyboard"
+#define GROUP_COMMANDS "Commands"
 
 static gchar *dup_key_string(GKeyFile *kf, const gchar *group, const gchar *key) {
 	GError *error = NULL;
@@ -13,12 +19,155 @@ static gchar *dup_key_string(GKeyFile *kf, const gchar *group, const gchar *key)
 	return value; // may be NULL
 }
 
+// Returns the string value of key, or a copy of fallback if it is not set.
+static gchar *dup_key_string_default(GKeyFile *kf, const gchar *group, const gchar *key,
+                                     const gchar *fallback) {
+	gchar *value = dup_key_string(kf, group, key);
+	return value ? value : g_strdup(fallback);
+}
+
+// Returns the integer value of key, or fallback if it is not set. Sets error
+// if the key is present but not a valid integer.
+static gint get_key_int_default(GKeyFile *kf, const gchar *group, const gchar *key,
+                                gint fallback, GError **error) {
+	if (!g_key_file_has_key(kf, group, key, NULL)) return fallback;
+	return g_key_file_get_integer(kf, group, key, error);
+}
+
+// Returns the double value of key, or fallback if it is not set. Sets error
+// if the key is present but not a valid number.
+static gdouble get_key_double_default(GKeyFile *kf, const gchar *group, const gchar *key,
+                                      gdouble fallback, GError **error) {
+	if (!g_key_file_has_key(kf, group, key, NULL)) return fallback;
+	return g_key_file_get_double(kf, group, key, error);
+}
+
 static void set_error_missing(GError **error, const gchar *key, const gchar *group) {
 	if (!error) return;
 	g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_KEY_NOT_FOUND,
 	           "Missing required key: %s in group [%s]", key, group);
 }
 
+static void command_plan_free(duet_command_plan_t *plan) {
+	if (!plan) return;
+	for (guint i = 0; i < plan->n_steps; i++) g_strfreev(plan->steps[i].argv);
+	g_free(plan->steps);
+	g_free(plan);
+}
+
+// Parses vendor:product USB id pairs, e.g. 0b05:1b2c, into a rule table
+static gboolean parse_device_rules(const gchar *key, gchar **entries, duet_config_t *cfg, GError **error) {
+	guint count = g_strv_length(entries);
+	cfg->keyboard_devices = g_new0(duet_device_rule_t, count);
+	for (guint i = 0; i < count; i++) {
+		gchar **ids = g_strsplit(g_strstrip(entries[i]), ":", -1);
+		gboolean valid = g_strv_length(ids) == 2;
+		for (guint j = 0; valid && j < 2; j++) {
+			valid = strlen(ids[j]) == 4 && strspn(ids[j], "0123456789abcdefABCDEF") == 4;
+		}
+		if (!valid) {
+			g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+			           "Invalid device '%s' in %s (expected vendor:product, e.g. 0b05:1b2c)", entries[i], key);
+			g_strfreev(ids);
+			return FALSE;
+		}
+		cfg->keyboard_devices[i].vendor_id = g_ascii_strdown(ids[0], -1);
+		cfg->keyboard_devices[i].product_id = g_ascii_strdown(ids[1], -1);
+		cfg->n_keyboard_devices = i + 1;
+		g_strfreev(ids);
+	}
+	return cfg->n_keyboard_devices > 0;
+}
+
+static gboolean is_blank(const gchar *str) {
+	for (; *str; str++) if (!g_ascii_isspace(*str)) return FALSE;
+	return TRUE;
+}
+
+// Splits a layout command into argv steps on `;` and `&&`, honouring shell
+// quoting. The steps are run without a shell; a command using any other shell
+// syntax becomes a single `sh -c` step instead, with a warning, as the
+// command backend may still be used as a fallback for a native one.
+static duet_command_plan_t *parse_command_plan(const gchar *key, const gchar *command, GError **error) {
+	GArray *steps = g_array_new(FALSE, TRUE, sizeof(duet_command_step_t));
+	GString *segment = g_string_new(NULL);
+	gboolean and_then = FALSE;
+	gchar quote = 0;
+	gchar unsupported = 0;
+
+	for (const gchar *p = command; ; p++) {
+		gchar c = *p;
+
+		if (c && quote) {
+			if (quote == '"' && (c == '$' || c == '`')) { unsupported = c; break; }
+			if (quote == '"' && c == '\\' && p[1]) g_string_append_c(segment, *p++);
+			else if (c == quote) quote = 0;
+			g_string_append_c(segment, *p);
+			continue;
+		}
+		if (c == '\'' || c == '"') {
+			quote = c;
+		} else if (c == '\\' && p[1]) {
+			g_string_append_c(segment, *p++);
+		} else if (c == '\0' || c == ';' || (c == '&' && p[1] == '&')) {
+			// End of a step. Empty steps are only allowed after `;`.
+			if (!and_then && is_blank(segment->str)) {
+				if (c == '&') { unsupported = c; break; }
+			} else {
+				duet_command_step_t step = {.and_then = and_then};
+				GError *local_error = NULL;
+				if (!g_shell_parse_argv(segment->str, NULL, &step.argv, &local_error)) {
+					g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+					           "Invalid step \"%s\" in %s: %s", g_strstrip(segment->str), key,
+					           local_error->message);
+					g_error_free(local_error);
+					goto fail;
+				}
+				g_array_append_val(steps, step);
+			}
+			g_string_truncate(segment, 0);
+			and_then = c == '&';
+			if (!c) break;
+			if (and_then) p++;
+			continue;
+		} else if (strchr("|&<>`$(){}", c)) {
+			unsupported = c;
+			break;
+		}
+		g_string_append_c(segment, *p);
+	}
+
+	if (unsupported) {
+		g_printerr("Warning: shell syntax '%c' in %s, running it with sh -c. "
+		           "Join commands with only ';' or '&&' to run them without a shell.\n",
+		           unsupported, key);
+		for (guint i = 0; i < steps->len; i++) g_strfreev(g_array_index(steps, duet_command_step_t, i).argv);
+		g_array_set_size(steps, 0);
+		duet_command_step_t step = {.argv = g_new0(gchar *, 4)};
+		step.argv[0] = g_strdup("sh");
+		step.argv[1] = g_strdup("-c");
+		step.argv[2] = g_strdup(command);
+		g_array_append_val(steps, step);
+	}
+	if (steps->len == 0) {
+		g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+		           "%s does not contain a command", key);
+		goto fail;
+	}
+
+	g_string_free(segment, TRUE);
+	duet_command_plan_t *plan = g_new0(duet_command_plan_t, 1);
+	plan->n_steps = steps->len;
+	plan->steps = (duet_command_step_t *)g_array_free(steps, FALSE);
+	return plan;
+
+fail:
+	for (guint i = 0; i < steps->len; i++) g_strfreev(g_array_index(steps, duet_command_step_t, i).argv);
+	g_array_free(steps, TRUE);
+	g_string_free(segment, TRUE);
+	return NULL;
+}
+
 duet_config_t *duet_config_load(const gchar *config_path, GError **error) {
 	GError *local_error = NULL;
 	GKeyFile *key_file = g_key_file_new();
@@ -71,11 +220,32 @@ duet_config_t *duet_config_load(const gchar *config_path, GError **error) {
 
 	// Parse display paths
 	cfg->source_display = dup_key_string(key_file, GROUP_BRIGHTNESS, "SOURCE_DISPLAY");
-	cfg->target_display = dup_key_string(key_file, GROUP_BRIGHTNESS, "TARGET_DISPLAY");
+	cfg->target_displays = g_key_file_get_string_list(key_file, GROUP_BRIGHTNESS, "TARGET_DISPLAY", NULL, NULL);
 
 	// Validate required display paths
 	if (!cfg->source_display) { set_error_missing(error, "SOURCE_DISPLAY", GROUP_BRIGHTNESS); goto fail; }
-	if (!cfg->target_display) { set_error_missing(error, "TARGET_DISPLAY", GROUP_BRIGHTNESS); goto fail; }
+	if (!cfg->target_displays || !cfg->target_displays[0]) { set_error_missing(error, "TARGET_DISPLAY", GROUP_BRIGHTNESS); goto fail; }
+
+	cfg->max_writes_per_second = get_key_int_default(key_file, GROUP_BRIGHTNESS, "MAX_WRITES_PER_SECOND", 30, &local_error);
+	if (local_error) { g_propagate_error(error, local_error); goto fail; }
+	if (cfg->max_writes_per_second < 0) {
+		g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+		           "MAX_WRITES_PER_SECOND in group [%s] must not be negative", GROUP_BRIGHTNESS);
+		goto fail;
+	}
+
+	cfg->brightness_gamma = get_key_double_default(key_file, GROUP_BRIGHTNESS, "GAMMA", 1.0, &local_error);
+	if (local_error) { g_propagate_error(error, local_error); goto fail; }
+	if (cfg->brightness_gamma <= 0) {
+		g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+		           "GAMMA in group [%s] must be positive", GROUP_BRIGHTNESS);
+		goto fail;
+	}
+
+	if (g_key_file_has_key(key_file, GROUP_BRIGHTNESS, "BIDIRECTIONAL", NULL)) {
+		cfg->bidirectional = g_key_file_get_boolean(key_file, GROUP_BRIGHTNESS, "BIDIRECTIONAL", &local_error);
+		if (local_error) { g_propagate_error(error, local_error); goto fail; }
+	}
 
 	// Required commands under [Layout Commands]
 	if (!g_key_file_has_group(key_file, GROUP_LAYOUT)) {
@@ -99,6 +269,113 @@ duet_config_t *duet_config_load(const gchar *config_path, GError **error) {
 	if (!cfg->portrait_right_command) { set_error_missing(error, "PORTRAIT_RIGHT_COMMAND", GROUP_LAYOUT); goto fail; }
 	if (!cfg->portrait_left_command) { set_error_missing(error, "PORTRAIT_LEFT_COMMAND", GROUP_LAYOUT); goto fail; }
 
+	// Split commands into steps now so errors surface at startup
+	if (!(cfg->single_monitor_plan = parse_command_plan("SINGLE_MONITOR_COMMAND", cfg->single_monitor_command, error))) goto fail;
+	if (!(cfg->mirror_plan = parse_command_plan("MIRROR_COMMAND", cfg->mirror_command, error))) goto fail;
+	if (!(cfg->landscape_plan = parse_command_plan("LANDSCAPE_COMMAND", cfg->landscape_command, error))) goto fail;
+	if (!(cfg->portrait_right_plan = parse_command_plan("PORTRAIT_RIGHT_COMMAND", cfg->portrait_right_command, error))) goto fail;
+	if (!(cfg->portrait_left_plan = parse_command_plan("PORTRAIT_LEFT_COMMAND", cfg->portrait_left_command, error))) goto fail;
+
+	if (g_key_file_has_key(key_file, GROUP_LAYOUT, "INDEPENDENT_STEPS", NULL)) {
+		cfg->independent_steps = g_key_file_get_boolean(key_file, GROUP_LAYOUT, "INDEPENDENT_STEPS", &local_error);
+		if (local_error) { g_propagate_error(error, local_error); goto fail; }
+	}
+
+	// Optional [Display] group
+	cfg->display_backend = dup_key_string_default(key_file, GROUP_DISPLAY, "BACKEND", "auto");
+	cfg->primary_output = dup_key_string_default(key_file, GROUP_DISPLAY, "PRIMARY_OUTPUT", "eDP-1");
+	cfg->secondary_output = dup_key_string_default(key_file, GROUP_DISPLAY, "SECONDARY_OUTPUT", "eDP-2");
+
+	if (!g_strv_contains((const gchar *[]){"auto", "hyprland", "niri", "command", NULL},
+	                     cfg->display_backend)) {
+		g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+		           "Invalid BACKEND in group [%s]: %s (expected auto, hyprland, niri or command)",
+		           GROUP_DISPLAY, cfg->display_backend);
+		goto fail;
+	}
+
+	cfg->command_timeout_ms = get_key_int_default(key_file, GROUP_DISPLAY, "COMMAND_TIMEOUT_MS", 5000, &local_error);
+	if (local_error) { g_propagate_error(error, local_error); goto fail; }
+	if (cfg->command_timeout_ms <= 0) {
+		g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+		           "COMMAND_TIMEOUT_MS in group [%s] must be positive", GROUP_DISPLAY);
+		goto fail;
+	}
+
+	cfg->settle_ms = get_key_int_default(key_file, GROUP_DISPLAY, "SETTLE_MS", 150, &local_error);
+	if (local_error) { g_propagate_error(error, local_error); goto fail; }
+	if (cfg->settle_ms < 0) {
+		g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+		           "SETTLE_MS in group [%s] must not be negative", GROUP_DISPLAY);
+		goto fail;
+	}
+
+	// Orientation source, optional under [Rotation]
+	cfg->rotation_backend = dup_key_string_default(key_file, GROUP_ROTATION, "BACKEND", "proxy");
+	if (!g_strv_contains((const gchar *[]){"proxy", "iio", NULL}, cfg->rotation_backend)) {
+		g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+		           "Invalid BACKEND in group [%s]: %s (expected proxy or iio)",
+		           GROUP_ROTATION, cfg->rotation_backend);
+		goto fail;
+	}
+	cfg->iio_device_root = dup_key_string_default(key_file, GROUP_ROTATION, "IIO_DEVICE_ROOT", "/sys/bus/iio/devices");
+
+	cfg->rotation_hysteresis = get_key_int_default(key_file, GROUP_ROTATION, "HYSTERESIS_DEGREES", 15, &local_error);
+	if (local_error) { g_propagate_error(error, local_error); goto fail; }
+	if (cfg->rotation_hysteresis < 0 || cfg->rotation_hysteresis >= 45) {
+		g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+		           "HYSTERESIS_DEGREES in group [%s] must be between 0 and 44", GROUP_ROTATION);
+		goto fail;
+	}
+
+	cfg->rotation_poll_ms = get_key_int_default(key_file, GROUP_ROTATION, "POLL_MS", 100, &local_error);
+	if (local_error) { g_propagate_error(error, local_error); goto fail; }
+	if (cfg->rotation_poll_ms <= 0) {
+		g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+		           "POLL_MS in group [%s] must be positive", GROUP_ROTATION);
+		goto fail;
+	}
+
+	if (g_key_file_has_key(key_file, GROUP_ROTATION, "COMPARE_PROXY", NULL)) {
+		cfg->rotation_compare_proxy = g_key_file_get_boolean(key_file, GROUP_ROTATION, "COMPARE_PROXY", &local_error);
+		if (local_error) { g_propagate_error(error, local_error); goto fail; }
+	}
+
+	// Keyboard devices, optional under [Keyboard]; defaults to the UX8406 keyboard
+	gchar **devices = g_key_file_get_string_list(key_file, GROUP_KEYBOARD, "DEVICES", NULL, NULL);
+	if (!devices) devices = g_strsplit("0b05:1b2c", ";", -1);
+	gboolean devices_ok = parse_device_rules("DEVICES", devices, cfg, error);
+	g_strfreev(devices);
+	if (!devices_ok) {
+		if (cfg->n_keyboard_devices == 0 && error && !*error) set_error_missing(error, "DEVICES", GROUP_KEYBOARD);
+		goto fail;
+	}
+	cfg->keyboard_udev_tag = dup_key_string(key_file, GROUP_KEYBOARD, "UDEV_TAG");
+	cfg->keyboard_switch_device = dup_key_string(key_file, GROUP_KEYBOARD, "SWITCH_DEVICE");
+	if (cfg->keyboard_switch_device && g_str_equal(cfg->keyboard_switch_device, "none"))
+		g_clear_pointer(&cfg->keyboard_switch_device, g_free);
+	if (g_key_file_has_key(key_file, GROUP_KEYBOARD, "WATCH_INPUT_NODES", NULL)) {
+		cfg->keyboard_watch_input_nodes = g_key_file_get_boolean(key_file, GROUP_KEYBOARD, "WATCH_INPUT_NODES", &local_error);
+		if (local_error) { g_propagate_error(error, local_error); goto fail; }
+	}
+
+	// Command socket limits, optional under [Commands]
+	cfg->max_clients = get_key_int_default(key_file, GROUP_COMMANDS, "MAX_CLIENTS", 32, &local_error);
+	if (local_error) { g_propagate_error(error, local_error); goto fail; }
+	if (cfg->max_clients <= 0) {
+		g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+		           "MAX_CLIENTS in group [%s] must be positive", GROUP_COMMANDS);
+		goto fail;
+	}
+
+	cfg->client_idle_timeout_ms = get_key_int_default(key_file, GROUP_COMMANDS, "IDLE_TIMEOUT_MS", 10000, &local_error);
+	if (local_error) { g_propagate_error(error, local_error); goto fail; }
+	if (cfg->client_idle_timeout_ms < 0) {
+		g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+		           "IDLE_TIMEOUT_MS in group [%s] must not be negative", GROUP_COMMANDS);
+		goto fail;
+	}
+
 	g_key_file_unref(key_file);
 	return cfg;
 
@@ -111,11 +388,28 @@ fail:
 void duet_config_free(duet_config_t *config) {
 	if (!config) return;
 	g_free(config->source_display);
-	g_free(config->target_display);
+	g_strfreev(config->target_displays);
 	g_free(config->single_monitor_command);
 	g_free(config->mirror_command);
 	g_free(config->landscape_command);
 	g_free(config->portrait_right_command);
 	g_free(config->portrait_left_command);
+	command_plan_free(config->single_monitor_plan);
+	command_plan_free(config->mirror_plan);
+	command_plan_free(config->landscape_plan);
+	command_plan_free(config->portrait_right_plan);
+	command_plan_free(config->portrait_left_plan);
+	g_free(config->display_backend);
+	g_free(config->primary_output);
+	g_free(config->secondary_output);
+	g_free(config->rotation_backend);
+	g_free(config->iio_device_root);
+	for (guint i = 0; i < config->n_keyboard_devices; i++) {
+		g_free(config->keyboard_devices[i].vendor_id);
+		g_free(config->keyboard_devices[i].product_id);
+	}
+	g_free(config->keyboard_devices);
+	g_free(config->keyboard_udev_tag);
+	g_free(config->keyboard_switch_device);
 	g_free(config);
 }
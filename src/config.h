@@ -2,11 +2,38 @@
 
 #include <glib.h>
 
+typedef struct duet_command_step_s {
+	// NULL terminated argv, argv[0] is looked up in PATH
+	gchar **argv;
+	// Whether the step was joined with && and only runs if the previous step succeeded
+	gboolean and_then;
+} duet_command_step_t;
+
+// A layout command split into steps on `;` and `&&` at load time
+typedef struct duet_command_plan_s {
+	duet_command_step_t *steps;
+	guint n_steps;
+} duet_command_plan_t;
+
+// A USB device matched by its vendor and product id
+typedef struct duet_device_rule_s {
+	// Lowercase 4 digit hex ids, as in the ID_VENDOR_ID and ID_MODEL_ID udev properties
+	gchar *vendor_id;
+	gchar *product_id;
+} duet_device_rule_t;
+
 typedef struct duet_config_s {
 	// Brightness sync settings (group: [Brightness Sync])
 	gboolean sync_brightness;
 	gchar *source_display;
-	gchar *target_display;
+	// TARGET_DISPLAY may list several panels separated by ';'
+	gchar **target_displays;
+	// Cap on target write passes per second, 0 for no limit
+	gint max_writes_per_second;
+	// Exponent applied when mapping source brightness onto each target's range
+	gdouble brightness_gamma;
+	// Whether target changes are propagated back to the source and other targets
+	gboolean bidirectional;
 
 	// Layout commands (group: [Layout Commands])
 	gchar *single_monitor_command;
@@ -14,6 +41,48 @@ typedef struct duet_config_s {
 	gchar *landscape_command;
 	gchar *portrait_right_command;
 	gchar *portrait_left_command;
+	duet_command_plan_t *single_monitor_plan;
+	duet_command_plan_t *mirror_plan;
+	duet_command_plan_t *landscape_plan;
+	duet_command_plan_t *portrait_right_plan;
+	duet_command_plan_t *portrait_left_plan;
+	// Whether `;` separated steps may run concurrently
+	gboolean independent_steps;
+
+	// Display backend settings (group: [Display], optional)
+	gchar *display_backend;
+	gchar *primary_output;
+	gchar *secondary_output;
+	gint command_timeout_ms;
+	gint settle_ms;
+
+	// Orientation source settings (group: [Rotation], optional)
+	// proxy for iio-sensor-proxy, iio to read the accelerometer directly
+	gchar *rotation_backend;
+	// Directory holding the iio:deviceN entries, /sys/bus/iio/devices
+	gchar *iio_device_root;
+	// Degrees past the halfway point a rotation must go before it switches
+	gint rotation_hysteresis;
+	gint rotation_poll_ms;
+	// Whether to also follow iio-sensor-proxy to log how far behind it is
+	gboolean rotation_compare_proxy;
+
+	// Keyboard detection settings (group: [Keyboard], optional)
+	duet_device_rule_t *keyboard_devices;
+	guint n_keyboard_devices;
+	// Only watch USB devices with this udev tag if set
+	gchar *keyboard_udev_tag;
+	// Tablet mode switch event node or "auto" for early detach, NULL if unused
+	gchar *keyboard_switch_device;
+	// Whether a hangup of the keyboard's own input nodes counts as early detach
+	gboolean keyboard_watch_input_nodes;
+
+	// Command socket limits (group: [Commands], optional)
+	// Clients served at once; more wait in the listen backlog
+	gint max_clients;
+	// Milliseconds a client may stay connected without sending or waiting for
+	// a reply, 0 for no limit
+	gint client_idle_timeout_ms;
 } duet_config_t;
 
 // Loads configuration from `config.ini` adjacent to the executable working directory
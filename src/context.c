@@ -10,3 +10,28 @@ int parse_orientation(const gchar *orientation_str) {
 
   return -1;
 }
+
+static const char *mode_names[] = {"auto", "mirror", "landscape",
+                                   "portrait-90", "portrait-270"};
+static const char *rotation_names[] = {"landscape", "portrait-90",
+                                       "portrait-270"};
+
+const char *mode_name(int mode) {
+  if (mode < MODE_AUTO || mode > MODE_PORTRAIT_270)
+    return "unknown";
+  return mode_names[mode];
+}
+
+int parse_mode(const gchar *name) {
+  for (int mode = MODE_AUTO; mode <= MODE_PORTRAIT_270; mode++) {
+    if (g_strcmp0(name, mode_names[mode]) == 0)
+      return mode;
+  }
+  return -1;
+}
+
+const char *rotation_name(int rotation) {
+  if (rotation < ROTATION_LANDSCAPE || rotation > ROTATION_PORTRAIT_270)
+    return "unknown";
+  return rotation_names[rotation];
+}
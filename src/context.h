@@ -34,3 +34,15 @@ struct DuetContext {
 } typedef duet_context_t;
 
 int parse_orientation(const gchar *orientation_str);
+
+/** The mode's name as accepted by the CLI, e.g. portrait-90 */
+const char *mode_name(int mode);
+
+/**
+ * Parses a mode name as returned by mode_name().
+ * @return The MODE_* value, or -1 if the name is unknown.
+ */
+int parse_mode(const gchar *name);
+
+/** The rotation's name, e.g. portrait-90 */
+const char *rotation_name(int rotation);
@@ -6,19 +6,81 @@
 #include "display.h"
 #include "command.h"
 #include "context.h"
+#include "handoff.h"
 #include "keyboard.h"
 #include "rotation.h"
+#include "service.h"
+#include "state.h"
 #include "brightness.h"
 
+#define CONFIG_PATH "/etc/duet.ini"
+// Extra time a previous duetd gets to hand over, beyond finishing a layout
+// change that may run up to the command timeout and waiting for its clients
+// to finish or time out idle
+#define HANDOFF_GRACE_MS 1000
+
+// The config loaded at startup, used by the display module for the lifetime
+// of the daemon. Reloads only apply the brightness settings.
+static duet_config_t *config = NULL;
+static duet_config_t *brightness_config = NULL;
+static GMainLoop *loop = NULL;
+
+static gboolean handle_sighup(gpointer data) {
+  GError *error = NULL;
+  duet_config_t *reloaded = duet_config_load(CONFIG_PATH, &error);
+  if (!reloaded) {
+    g_printerr("Failed to reload config: %s\n", error->message);
+    g_error_free(error);
+    return G_SOURCE_CONTINUE;
+  }
+
+  g_print("Reloading brightness settings from %s\n", CONFIG_PATH);
+  if (reloaded->sync_brightness) {
+    brightness_reload(reloaded);
+  } else if (brightness_config->sync_brightness) {
+    brightness_cleanup();
+  }
+
+  if (brightness_config != config) {
+    duet_config_free(brightness_config);
+  }
+  brightness_config = reloaded;
+  return G_SOURCE_CONTINUE;
+}
+
+// Logs how long a startup phase took and returns when it ended
+static gint64 log_phase(const char *phase, gint64 since) {
+  gint64 now = g_get_monotonic_time();
+  g_print("Startup: %s took %.1f ms\n", phase, (now - since) / 1000.0);
+  return now;
+}
+
 static gboolean handle_sigint(gpointer data) {
-  GMainLoop *loop = data;
   g_main_loop_quit(loop);
   return G_SOURCE_REMOVE;
 }
 
+// Serves commands once a previous duetd handed over its socket and state, or
+// was found missing. Only its mode and layout are taken over: keyboard and
+// orientation may already have been reported live since startup, and a
+// layout they no longer match is changed right away.
+static void handoff_received(int listen_fd, const duet_context_t *state,
+                             int layout, gpointer data) {
+  duet_context_t *status = data;
+  if (state) {
+    status->mode = state->mode;
+    display_restore_layout(status, state, layout);
+    display_schedule_layout(status, TRUE, 0);
+  }
+  command_watch(status, config, listen_fd);
+  handoff_listen(status, handle_sigint, NULL);
+  display_startup_done(status, STARTUP_HANDOFF);
+}
+
 int main() {
+  gint64 start = g_get_monotonic_time();
   GError *cfg_err = NULL;
-  duet_config_t *config = duet_config_load("/etc/duet.ini", &cfg_err);
+  config = duet_config_load(CONFIG_PATH, &cfg_err);
   if (cfg_err) {
     g_printerr("Failed to load config: %s\n", cfg_err->message);
     g_printerr("Please create a config file at /etc/duet.ini\n");
@@ -26,26 +88,54 @@ int main() {
     return 1;
   }
 
+  gint64 phase = log_phase("config", start);
+
   duet_context_t status = {.keyboardConnected = 1,
                            .rotation = ROTATION_LANDSCAPE,
                            .mode = MODE_AUTO};
+  // Start from the last run's state, so a selected mode survives a restart
+  // and the first layout is usually the one already showing. A duetd that is
+  // still running hands over its live state and command socket later.
+  int saved_layout = -1;
+  gboolean restored = state_load(&status, &saved_layout);
 
+  // Every subsystem starts without blocking on the others. Layout updates
+  // are held until keyboard and orientation state are known and a previous
+  // duetd handed over.
+  loop = g_main_loop_new(NULL, TRUE);
+  display_startup_begin(&status);
   display_set_config(config);
+  if (restored) {
+    display_restore_layout(&status, &status, saved_layout);
+  }
+  phase = log_phase("display backend", phase);
 
-  keyboard_watch(&status);
-  rotation_watch(&status);
-  command_watch(&status);
+  keyboard_watch(&status, config);
+  phase = log_phase("keyboard watch", phase);
+  rotation_watch(&status, config);
+  phase = log_phase("rotation watch", phase);
+  handoff_receive(config->command_timeout_ms +
+                      config->client_idle_timeout_ms + HANDOFF_GRACE_MS,
+                  handoff_received, &status);
+  phase = log_phase("handoff request", phase);
+  service_watch(&status);
+  phase = log_phase("D-Bus service", phase);
+  brightness_config = config;
   if (config->sync_brightness) {
     brightness_watch(config);
+    phase = log_phase("brightness sync", phase);
   }
+  log_phase("initialization", start);
 
-  GMainLoop *loop = g_main_loop_new(NULL, TRUE);
-  g_unix_signal_add(SIGINT, handle_sigint, loop);
+  g_unix_signal_add(SIGINT, handle_sigint, NULL);
+  g_unix_signal_add(SIGHUP, handle_sighup, NULL);
   g_main_loop_run(loop);
 
-  if (config->sync_brightness) {
+  if (brightness_config->sync_brightness) {
     brightness_cleanup();
   }
+  handoff_cleanup();
+  service_cleanup();
   command_cleanup();
   rotation_cleanup();
   keyboard_cleanup();
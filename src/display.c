@@ -1,15 +1,66 @@
 #include "display.h"
 #include "config.h"
 
+#include <gio/gio.h>
 #include <glib.h>
 #include <stdio.h>
 
+#include "command.h"
+#include "hyprland.h"
+#include "niri.h"
+#include "service.h"
+#include "spawn.h"
+#include "state.h"
+#include "trace.h"
 
+static gboolean command_available(void);
+static gboolean command_apply(const display_layout_t *layout,
+                              GCancellable *cancellable, GError **error);
+
+// Runs the configured layout commands. Used when no native compositor
+// backend is available, or as a fallback when one fails.
+static const display_backend_t command_backend = {
+    .name = "command",
+    .available = command_available,
+    .apply = command_apply,
+};
+
+static const display_backend_t *backends[] = {&hyprland_backend, &niri_backend,
+                                              &command_backend};
 
 static const duet_config_t *config = NULL;
+static const display_backend_t *backend = &command_backend;
+
+static void subscribe_outputs(void);
 
 void display_set_config(const duet_config_t *cfg) {
   config = cfg;
+
+  for (gsize i = 0; i < G_N_ELEMENTS(backends); i++) {
+    if (backends[i]->init) {
+      backends[i]->init();
+    }
+  }
+
+  backend = &command_backend;
+  for (gsize i = 0; i < G_N_ELEMENTS(backends); i++) {
+    if (g_str_equal(config->display_backend, backends[i]->name)) {
+      backend = backends[i];
+      break;
+    }
+    if (g_str_equal(config->display_backend, "auto") &&
+        backends[i]->available()) {
+      backend = backends[i];
+      break;
+    }
+  }
+
+  g_print("Using %s display backend\n", backend->name);
+  g_print("Layout settle window: %d ms\n", config->settle_ms);
+
+  if (backend->subscribe) {
+    subscribe_outputs();
+  }
 }
 
 void system_fmt(char *format, ...) {
@@ -21,8 +72,153 @@ void system_fmt(char *format, ...) {
   va_end(args);
 }
 
+// Give up waiting for startup state after this long
+#define STARTUP_TIMEOUT_MS 3000
+
+static int startup_pending =
+    STARTUP_KEYBOARD | STARTUP_ROTATION | STARTUP_HANDOFF;
+static gint64 startup_start = 0;
+static guint startup_timeout_id = 0;
+
+static guint settle_id = 0;
+static guint settle_events = 0;
+static duet_context_t *settle_context = NULL;
+// The latest input event coalesced into the settle window, and the one the
+// next layout change is traced under
+static guint settle_trace_id = 0;
+static gint64 settle_trace_start = 0;
+static guint layout_trace_id = 0;
+static gint64 layout_trace_start = 0;
+
+static GCancellable *apply_cancellable = NULL;
+
+typedef struct {
+  display_idle_func func;
+  gpointer data;
+} idle_waiter_t;
+
+static GQueue idle_waiters = G_QUEUE_INIT;
+
+static gboolean settle_done(gpointer data) {
+  settle_id = 0;
+  if (settle_events > 1) {
+    g_print("Coalesced %u events into one layout update\n", settle_events);
+  }
+  settle_events = 0;
+  layout_trace_id = settle_trace_id;
+  layout_trace_start = settle_trace_start;
+  settle_trace_id = 0;
+  trace_stage(layout_trace_id, "settle", layout_trace_start,
+              g_get_monotonic_time());
+  setLayout(settle_context);
+  return G_SOURCE_REMOVE;
+}
+
+/**
+ * Schedules a layout update for the context. Events arriving within the
+ * settle window are coalesced into a single setLayout() with the latest state.
+ * @param context The device status.
+ * @param immediate Apply now instead of waiting for the window to close.
+ * @param trace_id The input event that caused the update, 0 if none. The
+ * layout change is traced under the latest one in the window.
+ */
+void display_schedule_layout(duet_context_t *context, gboolean immediate,
+                             guint trace_id) {
+  settle_context = context;
+  if (trace_id) {
+    settle_trace_id = trace_id;
+    settle_trace_start = g_get_monotonic_time();
+  }
+  command_publish_state();
+  service_publish_state();
+  // Held until display_startup_done() has everything the first layout needs
+  if (startup_pending) {
+    return;
+  }
+  settle_events++;
+
+  if (immediate || config->settle_ms == 0) {
+    if (settle_id) {
+      g_source_remove(settle_id);
+    }
+    settle_done(NULL);
+  } else if (!settle_id) {
+    settle_id = g_timeout_add(config->settle_ms, settle_done, NULL);
+  }
+}
+
+static void finish_startup(duet_context_t *context) {
+  startup_pending = 0;
+  if (startup_timeout_id) {
+    g_source_remove(startup_timeout_id);
+    startup_timeout_id = 0;
+  }
+  g_print("Startup: applying first layout after %.1f ms\n",
+          (g_get_monotonic_time() - startup_start) / 1000.0);
+  // Traced under the last event held back, if any
+  display_schedule_layout(context, TRUE, 0);
+}
+
+static gboolean startup_timeout(gpointer data) {
+  startup_timeout_id = 0;
+  g_print("Startup: still waiting for%s%s%s after %d ms, continuing\n",
+          startup_pending & STARTUP_KEYBOARD ? " keyboard" : "",
+          startup_pending & STARTUP_ROTATION ? " orientation" : "",
+          startup_pending & STARTUP_HANDOFF ? " handoff" : "",
+          STARTUP_TIMEOUT_MS);
+  finish_startup(data);
+  return G_SOURCE_REMOVE;
+}
+
+void display_startup_begin(duet_context_t *context) {
+  startup_start = g_get_monotonic_time();
+  startup_timeout_id =
+      g_timeout_add(STARTUP_TIMEOUT_MS, startup_timeout, context);
+}
+
+void display_startup_done(duet_context_t *context, int part) {
+  if (!(startup_pending & part)) {
+    return;
+  }
+  startup_pending &= ~part;
+  g_print("Startup: %s known after %.1f ms\n",
+          part == STARTUP_KEYBOARD   ? "keyboard state"
+          : part == STARTUP_ROTATION ? "orientation"
+                                     : "previous instance",
+          (g_get_monotonic_time() - startup_start) / 1000.0);
+
+  // Orientation only matters once the keyboard is known to be detached
+  if ((startup_pending & (STARTUP_KEYBOARD | STARTUP_HANDOFF)) ||
+      ((startup_pending & STARTUP_ROTATION) && !context->keyboardConnected)) {
+    return;
+  }
+  finish_startup(context);
+}
+
 static duet_context_t lastContext = {
     .keyboardConnected = -1, .rotation = -1, .mode = -1};
+// The layout last applied or verified, -1 if unknown
+static int applied_layout = -1;
+
+// Answers the idle waiters once no layout update is held, settling or running
+static void check_idle(void) {
+  if (startup_pending || settle_id || apply_cancellable) {
+    return;
+  }
+  idle_waiter_t *waiter;
+  while ((waiter = g_queue_pop_head(&idle_waiters))) {
+    waiter->func(applied_layout, waiter->data);
+    g_free(waiter);
+  }
+}
+
+void display_when_idle(display_idle_func func, gpointer data) {
+  idle_waiter_t *waiter = g_new(idle_waiter_t, 1);
+  waiter->func = func;
+  waiter->data = data;
+  g_queue_push_tail(&idle_waiters, waiter);
+  check_idle();
+}
 /**
  * Sets the layout for a given keyboard and rotation status
  * @param context The device status.
@@ -36,20 +232,24 @@ void setLayout(duet_context_t *context) {
 
   Then there's no need to update display.
   */
-  if ((lastContext.keyboardConnected && context->keyboardConnected) ||
+  gboolean unchanged =
+      (lastContext.keyboardConnected && context->keyboardConnected) ||
       (lastContext.keyboardConnected == context->keyboardConnected &&
        lastContext.mode == context->mode &&
        (lastContext.rotation == context->rotation ||
-        context->mode != MODE_AUTO))) {
-    lastContext.keyboardConnected = context->keyboardConnected;
-    lastContext.mode = context->mode;
-    lastContext.rotation = context->rotation;
-    return;
-  }
+        context->mode != MODE_AUTO));
   lastContext.keyboardConnected = context->keyboardConnected;
   lastContext.mode = context->mode;
   lastContext.rotation = context->rotation;
 
+  // Backends that can query the compositor diff against its real state
+  // instead, which also catches outputs changed behind our back.
+  if (unchanged && !backend->query) {
+    state_save(context, applied_layout);
+    check_idle();
+    return;
+  }
+
   g_print("Updating layout - keyboard: %d, rotation: %d, mode: %d\n",
           context->keyboardConnected, context->rotation, context->mode);
 
@@ -75,33 +275,495 @@ void setLayout(duet_context_t *context) {
   } else if (context->mode == MODE_PORTRAIT_270) {
     setPortrait270();
   }
+  check_idle();
+}
+
+// Fills in the output description for a layout id.
+static void build_layout(int id, display_layout_t *layout) {
+  *layout = (display_layout_t){
+      .id = id,
+      .primary = {.name = config->primary_output,
+                  .enabled = TRUE,
+                  .changes = DIFF_ALL},
+      .secondary = {.name = config->secondary_output,
+                    .enabled = TRUE,
+                    .changes = DIFF_ALL},
+  };
+
+  switch (id) {
+  case LAYOUT_SINGLE_MONITOR:
+    layout->secondary.enabled = FALSE;
+    break;
+  case LAYOUT_MIRROR:
+    layout->secondary.mirror = TRUE;
+    break;
+  case LAYOUT_LANDSCAPE:
+    layout->secondary.placement = PLACEMENT_BELOW;
+    break;
+  case LAYOUT_PORTRAIT_90:
+    layout->primary.transform = 90;
+    layout->secondary.transform = 90;
+    layout->secondary.placement = PLACEMENT_LEFT;
+    break;
+  case LAYOUT_PORTRAIT_270:
+    layout->primary.transform = 270;
+    layout->secondary.transform = 270;
+    layout->secondary.placement = PLACEMENT_RIGHT;
+    break;
+  }
+}
+
+display_output_state_t *display_state_lookup(display_state_t *state,
+                                             const gchar *name) {
+  if (g_strcmp0(name, state->primary.name) == 0) {
+    return &state->primary;
+  }
+  if (g_strcmp0(name, state->secondary.name) == 0) {
+    return &state->secondary;
+  }
+  return NULL;
+}
+
+// Works out where an output sits relative to the primary output.
+static int actual_placement(const display_output_state_t *output,
+                            const display_output_state_t *primary) {
+  if (output->y >= primary->y + primary->height) {
+    return PLACEMENT_BELOW;
+  }
+  if (output->x + output->width <= primary->x) {
+    return PLACEMENT_LEFT;
+  }
+  if (output->x >= primary->x + primary->width) {
+    return PLACEMENT_RIGHT;
+  }
+  return PLACEMENT_AUTO;
+}
+
+static int diff_output(const display_output_t *target,
+                       const display_output_state_t *current,
+                       const display_output_state_t *primary) {
+  if (!current->present) {
+    return DIFF_ALL;
+  }
+  if (target->enabled != current->enabled) {
+    return target->enabled ? DIFF_ALL : DIFF_ENABLED;
+  }
+  if (!target->enabled) {
+    return 0;
+  }
+
+  // A backend without mirroring shows a mirrored output unrotated instead,
+  // so it is compared as such
+  gboolean mirror = target->mirror && backend->mirrors;
+  int changes = 0;
+  if (mirror != current->mirror) {
+    changes |= DIFF_MIRROR;
+  }
+  if (!mirror && target->transform != current->transform) {
+    changes |= DIFF_TRANSFORM;
+  }
+  if (!mirror && target->placement != PLACEMENT_AUTO &&
+      target->placement != actual_placement(current, primary)) {
+    changes |= DIFF_PLACEMENT;
+  }
+  return changes;
+}
+
+// Sets the changes of each output in the layout against the compositor's
+// current state and returns the number of outputs that need changing.
+static int diff_layout(display_layout_t *layout, const display_state_t *state) {
+  layout->primary.changes =
+      diff_output(&layout->primary, &state->primary, &state->primary);
+  layout->secondary.changes =
+      diff_output(&layout->secondary, &state->secondary, &state->primary);
+
+  // Moving the primary output moves the outputs placed relative to it
+  if (layout->primary.changes && layout->secondary.enabled &&
+      layout->secondary.placement != PLACEMENT_AUTO) {
+    layout->secondary.changes |= DIFF_PLACEMENT;
+  }
+
+  return (layout->primary.changes != 0) + (layout->secondary.changes != 0);
+}
+
+static gboolean command_available(void) { return TRUE; }
+
+static const duet_command_plan_t *layout_plan(int id) {
+  switch (id) {
+  case LAYOUT_SINGLE_MONITOR:
+    return config->single_monitor_plan;
+  case LAYOUT_MIRROR:
+    return config->mirror_plan;
+  case LAYOUT_LANDSCAPE:
+    return config->landscape_plan;
+  case LAYOUT_PORTRAIT_90:
+    return config->portrait_right_plan;
+  case LAYOUT_PORTRAIT_270:
+    return config->portrait_left_plan;
+  default:
+    return NULL;
+  }
+}
+
+static gboolean command_apply(const display_layout_t *layout,
+                              GCancellable *cancellable, GError **error) {
+  return spawn_plan(layout_plan(layout->id), config->independent_steps,
+                    cancellable, error);
+}
+
+const char *display_layout_name(int id) {
+  switch (id) {
+  case LAYOUT_SINGLE_MONITOR:
+    return "single-monitor";
+  case LAYOUT_MIRROR:
+    return "mirror";
+  case LAYOUT_LANDSCAPE:
+    return "landscape";
+  case LAYOUT_PORTRAIT_90:
+    return "portrait-90";
+  case LAYOUT_PORTRAIT_270:
+    return "portrait-270";
+  default:
+    return "unknown";
+  }
+}
+
+typedef struct {
+  display_layout_t layout;
+  /** Monotonic time the layout change was requested */
+  gint64 start_time;
+  /** The compositor's output state before the change */
+  display_state_t state;
+  gboolean have_state;
+  /** Number of outputs that needed changing */
+  int changed_outputs;
+  /** The input event the change is traced under, 0 if none */
+  guint trace_id;
+  gint64 trace_start;
+} apply_job_t;
+
+// The compositor's output state as last queried
+static display_state_t output_state;
+static gboolean output_state_valid = FALSE;
+// Bumped whenever a layout change starts or ends, so refreshes that raced
+// with one are discarded
+static guint state_generation = 0;
+static gboolean refresh_running = FALSE;
+static gboolean refresh_again = FALSE;
+static gboolean subscribed = FALSE;
+
+const display_state_t *display_get_output_state(void) {
+  return output_state_valid ? &output_state : NULL;
+}
+
+static void refresh_thread(GTask *task, gpointer source, gpointer task_data,
+                           GCancellable *cancellable) {
+  GError *error = NULL;
+  if (backend->query(task_data, cancellable, &error)) {
+    g_task_return_boolean(task, TRUE);
+  } else {
+    g_task_return_error(task, error);
+  }
+}
+
+static void refresh_outputs(void);
+
+static void refresh_done(GObject *source, GAsyncResult *result,
+                         gpointer data) {
+  const display_state_t *state = g_task_get_task_data(G_TASK(result));
+  GError *error = NULL;
+
+  refresh_running = FALSE;
+  if (!g_task_propagate_boolean(G_TASK(result), &error)) {
+    g_printerr("Failed to refresh outputs: %s\n", error->message);
+    g_error_free(error);
+  } else if (GPOINTER_TO_UINT(data) == state_generation) {
+    output_state = *state;
+    output_state_valid = TRUE;
+  }
+
+  if (refresh_again) {
+    refresh_again = FALSE;
+    refresh_outputs();
+  }
+}
+
+// Re-reads the compositor's output state on a worker thread.
+static void refresh_outputs(void) {
+  if (refresh_running) {
+    refresh_again = TRUE;
+    return;
+  }
+
+  display_state_t *state = g_new0(display_state_t, 1);
+  state->primary.name = config->primary_output;
+  state->secondary.name = config->secondary_output;
+
+  refresh_running = TRUE;
+  GTask *task = g_task_new(NULL, NULL, refresh_done,
+                           GUINT_TO_POINTER(state_generation));
+  g_task_set_task_data(task, state, g_free);
+  g_task_run_in_thread(task, refresh_thread);
+  g_object_unref(task);
+}
+
+static gboolean resubscribe(gpointer data) {
+  subscribe_outputs();
+  return G_SOURCE_REMOVE;
+}
+
+static void outputs_changed(gboolean closed) {
+  if (closed) {
+    g_printerr("Compositor event stream closed\n");
+    subscribed = FALSE;
+    output_state_valid = FALSE;
+    g_timeout_add_seconds(5, resubscribe, NULL);
+    return;
+  }
+  refresh_outputs();
+}
+
+// Follows the compositor's event stream to keep output_state current, so
+// layout changes can diff against it without querying first.
+static void subscribe_outputs(void) {
+  GError *error = NULL;
+  if (!backend->subscribe(outputs_changed, &error)) {
+    g_printerr("Failed to subscribe to %s events: %s\n", backend->name,
+               error->message);
+    g_error_free(error);
+    g_timeout_add_seconds(5, resubscribe, NULL);
+    return;
+  }
+  g_print("Following %s output events\n", backend->name);
+  subscribed = TRUE;
+  refresh_outputs();
+}
+
+static guint apply_timeout_id = 0;
+static int inflight_layout = -1;
+static int pending_layout = -1;
+
+static void applyLayout(int id);
+
+// Worker thread: applies the layout with the selected backend, falling back
+// to the layout commands if a native backend fails.
+static void apply_thread(GTask *task, gpointer source, gpointer task_data,
+                         GCancellable *cancellable) {
+  apply_job_t *job = task_data;
+  display_layout_t *layout = &job->layout;
+  GError *error = NULL;
+
+  // Only change what differs from the compositor's real state
+  if (backend->query && !job->have_state) {
+    gint64 query_start = g_get_monotonic_time();
+    job->have_state = backend->query(&job->state, cancellable, &error);
+    trace_stage(job->trace_id, "query outputs", query_start,
+                g_get_monotonic_time());
+    if (!job->have_state) {
+      if (g_cancellable_is_cancelled(cancellable)) {
+        g_task_return_error(task, error);
+        return;
+      }
+      g_printerr("Failed to query outputs: %s\n", error->message);
+      g_clear_error(&error);
+    }
+  }
+  job->changed_outputs = job->have_state ? diff_layout(layout, &job->state) : 2;
+  if (job->changed_outputs == 0) {
+    g_task_return_boolean(task, TRUE);
+    return;
+  }
+
+  gint64 apply_start = g_get_monotonic_time();
+  gboolean applied = backend->apply(layout, cancellable, &error);
+  trace_stage(job->trace_id, backend->name, apply_start,
+              g_get_monotonic_time());
+  if (applied) {
+    g_task_return_boolean(task, TRUE);
+    return;
+  }
+
+  if (backend != &command_backend &&
+      !g_cancellable_is_cancelled(cancellable)) {
+    g_printerr("Failed to apply layout with %s backend: %s\n", backend->name,
+               error->message);
+    g_clear_error(&error);
+    apply_start = g_get_monotonic_time();
+    applied = command_apply(layout, cancellable, &error);
+    trace_stage(job->trace_id, "command fallback", apply_start,
+                g_get_monotonic_time());
+    if (applied) {
+      g_task_return_boolean(task, TRUE);
+      return;
+    }
+  }
+
+  g_task_return_error(task, error);
+}
+
+static gboolean apply_timeout(gpointer data) {
+  g_printerr("Layout change timed out after %d ms\n",
+             config->command_timeout_ms);
+  apply_timeout_id = 0;
+  g_cancellable_cancel(apply_cancellable);
+  return G_SOURCE_REMOVE;
+}
+
+static void apply_done(GObject *source, GAsyncResult *result, gpointer data) {
+  const apply_job_t *job = g_task_get_task_data(G_TASK(result));
+  GError *error = NULL;
+
+  // The state is only known to be current if nothing had to change
+  output_state_valid = FALSE;
+  state_generation++;
+
+  gboolean applied = g_task_propagate_boolean(G_TASK(result), &error);
+  trace_stage(job->trace_id, applied ? "layout applied" : "layout not applied",
+              job->trace_start, g_get_monotonic_time());
+  if (applied) {
+    applied_layout = job->layout.id;
+    if (settle_context) {
+      state_save(settle_context, applied_layout);
+    }
+    command_publish_state();
+    service_publish_state();
+    if (job->changed_outputs == 0) {
+      g_print("Outputs already match %s layout\n",
+              display_layout_name(job->layout.id));
+      output_state = job->state;
+      output_state_valid = TRUE;
+    } else {
+      g_print("Applied %s layout to %d output(s) in %.1f ms\n",
+              display_layout_name(job->layout.id), job->changed_outputs,
+              (g_get_monotonic_time() - job->start_time) / 1000.0);
+    }
+  } else {
+    // The outputs may be anywhere between the old and new layout
+    applied_layout = -1;
+    command_publish_state();
+    service_publish_state();
+    if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+      g_printerr("Failed to apply layout: %s\n", error->message);
+    } else if (pending_layout != -1) {
+      g_print("Layout change superseded\n");
+    }
+    g_error_free(error);
+  }
+
+  if (apply_timeout_id) {
+    g_source_remove(apply_timeout_id);
+    apply_timeout_id = 0;
+  }
+  g_clear_object(&apply_cancellable);
+  inflight_layout = -1;
+
+  // Hyprland and niri report no event for every output change, so re-read
+  // the state rather than waiting for one
+  if (subscribed && job->changed_outputs && pending_layout == -1) {
+    refresh_outputs();
+  }
+
+  if (pending_layout != -1) {
+    int id = pending_layout;
+    pending_layout = -1;
+    applyLayout(id);
+  }
+  check_idle();
+}
+
+// Starts applying a layout on a worker thread. Only one layout change runs at
+// a time; a newer target cancels the one in flight and runs once it stops.
+static void applyLayout(int id) {
+  if (apply_cancellable) {
+    if (id == inflight_layout &&
+        !g_cancellable_is_cancelled(apply_cancellable)) {
+      pending_layout = -1;
+    } else {
+      pending_layout = id;
+      g_cancellable_cancel(apply_cancellable);
+    }
+    return;
+  }
+
+  // Without a way to query the compositor, trust that the last layout applied
+  // is still showing rather than running the commands again
+  if (!backend->query && id == applied_layout) {
+    g_print("Outputs already show %s layout\n", display_layout_name(id));
+    return;
+  }
+
+  apply_job_t *job = g_new0(apply_job_t, 1);
+  job->start_time = g_get_monotonic_time();
+  job->trace_id = layout_trace_id;
+  job->trace_start = layout_trace_start;
+  build_layout(id, &job->layout);
+  if (output_state_valid) {
+    job->state = output_state;
+    job->have_state = TRUE;
+  } else {
+    job->state.primary.name = config->primary_output;
+    job->state.secondary.name = config->secondary_output;
+  }
+
+  inflight_layout = id;
+  state_generation++;
+  apply_cancellable = g_cancellable_new();
+  apply_timeout_id =
+      g_timeout_add(config->command_timeout_ms, apply_timeout, NULL);
+
+  GTask *task = g_task_new(NULL, apply_cancellable, apply_done, NULL);
+  g_task_set_task_data(task, job, g_free);
+  g_task_run_in_thread(task, apply_thread);
+  g_object_unref(task);
 }
 
+void display_restore_layout(duet_context_t *context,
+                            const duet_context_t *saved, int layout) {
+  settle_context = context;
+  lastContext = *saved;
+  if (layout == -1) {
+    return;
+  }
+
+  // The state is from this session, so a backend that cannot verify it can
+  // assume it is still applied. Others check it against the compositor now,
+  // without waiting for the startup gate.
+  if (!backend->query) {
+    g_print("Restored %s layout from saved state\n", display_layout_name(layout));
+    applied_layout = layout;
+  } else {
+    g_print("Verifying %s layout from saved state\n", display_layout_name(layout));
+    applyLayout(layout);
+  }
+}
+
+int display_get_applied_layout(void) { return applied_layout; }
+
 // Mirrors the top display and bottom such that the top is flipped 180 (to be
 // someone accross a table).
 void setMirror() {
-  system(config->mirror_command);
+  applyLayout(LAYOUT_MIRROR);
 }
 
 // Disables the monitor under the keyboard
 void setSingleMonitor() {
-  system(config->single_monitor_command);
+  applyLayout(LAYOUT_SINGLE_MONITOR);
 }
 
 // Both monitors enabled in landscape mode (stacked vertically)
 void setLandscape() {
-  system(config->landscape_command);
+  applyLayout(LAYOUT_LANDSCAPE);
 }
 
 // Both monitors enabled in portrait mode, such that the primary monitor is on
 // the right and the keyboard side display is on the left (90 deg clockwise).
 void setPortrait90() {
-  system(config->portrait_right_command);
+  applyLayout(LAYOUT_PORTRAIT_90);
 }
 
 // Both monitors enabled in portrait mode, such that the primary monitor is on
 // the left and the keyboard side display is on the right (90 deg
 // counterclockwise).
 void setPortrait270() {
-  system(config->portrait_left_command);
+  applyLayout(LAYOUT_PORTRAIT_270);
 }
@@ -1,12 +1,173 @@
 #pragma once
 
+#include <gio/gio.h>
+
 #include "context.h"
 #include "config.h"
 
+#define LAYOUT_SINGLE_MONITOR 0
+#define LAYOUT_MIRROR 1
+#define LAYOUT_LANDSCAPE 2
+#define LAYOUT_PORTRAIT_90 3
+#define LAYOUT_PORTRAIT_270 4
+
+#define STARTUP_KEYBOARD (1 << 0)
+#define STARTUP_ROTATION (1 << 1)
+#define STARTUP_HANDOFF (1 << 2)
+
+#define PLACEMENT_AUTO 0
+#define PLACEMENT_BELOW 1
+#define PLACEMENT_LEFT 2
+#define PLACEMENT_RIGHT 3
+
+#define DIFF_ENABLED (1 << 0)
+#define DIFF_TRANSFORM (1 << 1)
+#define DIFF_PLACEMENT (1 << 2)
+#define DIFF_MIRROR (1 << 3)
+#define DIFF_ALL (DIFF_ENABLED | DIFF_TRANSFORM | DIFF_PLACEMENT | DIFF_MIRROR)
+
+typedef struct {
+  /** The output connector name, e.g. eDP-1 */
+  const gchar *name;
+  /** Whether the output is enabled */
+  gboolean enabled;
+  /** Clockwise rotation in degrees: 0, 90, 180 or 270 */
+  int transform;
+  /** Placement relative to the primary output */
+  int placement;
+  /** Whether the output mirrors the primary output */
+  gboolean mirror;
+  /** DIFF_* flags for what differs from the compositor's current state */
+  int changes;
+} display_output_t;
+
+typedef struct {
+  /** The layout id, one of LAYOUT_* */
+  int id;
+  /** The top display */
+  display_output_t primary;
+  /** The keyboard side display */
+  display_output_t secondary;
+} display_layout_t;
+
+typedef struct {
+  /** The output connector name, e.g. eDP-1 */
+  const gchar *name;
+  /** Whether the compositor reported the output */
+  gboolean present;
+  gboolean enabled;
+  /** Clockwise rotation in degrees: 0, 90, 180 or 270 */
+  int transform;
+  /** Logical geometry in the compositor's layout coordinates */
+  int x, y, width, height;
+  /** Whether the output mirrors another output */
+  gboolean mirror;
+} display_output_state_t;
+
+typedef struct {
+  display_output_state_t primary;
+  display_output_state_t secondary;
+} display_state_t;
+
+typedef struct {
+  /** The backend name as used for BACKEND in the config */
+  const char *name;
+  /**
+   * Looks up how to reach the compositor, on the main thread before any
+   * other call. NULL if there is nothing to look up.
+   */
+  void (*init)(void);
+  /**
+   * Returns whether the compositor for this backend can be reached. May run
+   * on a worker thread.
+   */
+  gboolean (*available)(void);
+  /**
+   * Whether the backend can mirror outputs. Without it a mirrored output is
+   * enabled unrotated at an automatic position instead.
+   */
+  gboolean mirrors;
+  /**
+   * Applies the outputs of the layout that have changes set, returning FALSE
+   * and setting error on failure. Runs on a worker thread and should return
+   * promptly once cancellable is cancelled.
+   */
+  gboolean (*apply)(const display_layout_t *layout, GCancellable *cancellable,
+                    GError **error);
+  /**
+   * Fills in the current state of the outputs named in state, or NULL if the
+   * backend cannot query the compositor. Runs on a worker thread.
+   */
+  gboolean (*query)(display_state_t *state, GCancellable *cancellable,
+                    GError **error);
+  /**
+   * Starts following the compositor's event stream on the main loop, calling
+   * changed(FALSE) whenever the outputs may have changed and changed(TRUE)
+   * once the stream closes. NULL if the backend has no event stream.
+   */
+  gboolean (*subscribe)(void (*changed)(gboolean closed), GError **error);
+  /** Stops following the event stream */
+  void (*unsubscribe)(void);
+} display_backend_t;
+
+/**
+ * Looks up the output with the given name in state.
+ * @return The output, or NULL if it is neither the primary nor secondary.
+ */
+display_output_state_t *display_state_lookup(display_state_t *state,
+                                             const gchar *name);
+
 void system_fmt(char *format, ...);
 
 void display_set_config(const duet_config_t *cfg);
 
+/**
+ * The compositor's output state as kept up to date from its event stream.
+ * @return The state, or NULL if it is not currently known.
+ */
+const display_state_t *display_get_output_state(void);
+
+void display_schedule_layout(duet_context_t *status, gboolean immediate,
+                             guint trace_id);
+
+/** Starts timing startup and holding layout updates until it completes */
+void display_startup_begin(duet_context_t *status);
+
+/**
+ * Marks part of the startup state, one of STARTUP_*, as known. The first
+ * layout is applied once a previous duetd handed over or was found missing,
+ * and the keyboard state and, with the keyboard detached, the orientation
+ * are known, or after a timeout.
+ */
+void display_startup_done(duet_context_t *status, int part);
+
+/**
+ * Restores the layout saved by a previous run. The layout is verified against
+ * the compositor right away if the backend can query it, otherwise it is
+ * assumed to still be applied.
+ * @param saved The context the layout was chosen for. Where the live status
+ * differs, the next layout update changes it.
+ * @param layout The saved layout id, or -1 if none was applied.
+ */
+void display_restore_layout(duet_context_t *status,
+                            const duet_context_t *saved, int layout);
+
+typedef void (*display_idle_func)(int layout, gpointer data);
+
+/**
+ * Calls func once no layout update is held, settling or being applied, right
+ * away if there is none. Waiters are called in the order they were added.
+ * @param func Called with the layout then showing, or -1 if it is unknown
+ * because the last change failed.
+ */
+void display_when_idle(display_idle_func func, gpointer data);
+
+/** The name of a LAYOUT_* id as used in logs and replies */
+const char *display_layout_name(int id);
+
+/** The layout last applied or verified, or -1 if unknown */
+int display_get_applied_layout(void);
+
 void setLayout(duet_context_t *status);
 
 void setMirror();
@@ -0,0 +1,190 @@
+#include "evdev.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/input.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#define BITS_PER_LONG (sizeof(unsigned long) * 8)
+#define NLONGS(bits) (((bits) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+
+typedef struct {
+  gchar *devnode;
+  evdev_gone_func gone;
+  gpointer data;
+  GDestroyNotify destroy;
+} node_watch_t;
+
+static GIOChannel *switch_channel;
+static guint switch_id;
+static evdev_switch_func switch_changed;
+static gpointer switch_data;
+/** Watched event nodes, devnode to source id */
+static GHashTable *node_watches;
+
+static gboolean test_bit(int bit, const unsigned long *bits) {
+  return (bits[bit / BITS_PER_LONG] >> (bit % BITS_PER_LONG)) & 1;
+}
+
+static gboolean has_tablet_switch(int fd) {
+  unsigned long bits[NLONGS(SW_CNT)] = {0};
+  return ioctl(fd, EVIOCGBIT(EV_SW, sizeof(bits)), bits) >= 0 &&
+         test_bit(SW_TABLET_MODE, bits);
+}
+
+// Opens device, or the first event node with a tablet mode switch for "auto"
+static int open_switch(const gchar *device) {
+  if (g_strcmp0(device, "auto") != 0) {
+    int fd = open(device, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1) {
+      g_printerr("Failed to open %s: %s\n", device, g_strerror(errno));
+    } else if (!has_tablet_switch(fd)) {
+      g_printerr("%s has no tablet mode switch\n", device);
+      close(fd);
+      fd = -1;
+    }
+    return fd;
+  }
+
+  GDir *dir = g_dir_open("/dev/input", 0, NULL);
+  if (!dir) {
+    return -1;
+  }
+  int fd = -1;
+  const gchar *name;
+  while (fd == -1 && (name = g_dir_read_name(dir))) {
+    if (!g_str_has_prefix(name, "event")) {
+      continue;
+    }
+    gchar *path = g_build_filename("/dev/input", name, NULL);
+    fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd != -1 && !has_tablet_switch(fd)) {
+      close(fd);
+      fd = -1;
+    }
+    g_free(path);
+  }
+  g_dir_close(dir);
+  if (fd == -1) {
+    g_printerr("No input device with a tablet mode switch found\n");
+  }
+  return fd;
+}
+
+static gboolean switch_event(GIOChannel *source, GIOCondition condition,
+                             gpointer data) {
+  int fd = g_io_channel_unix_get_fd(source);
+  struct input_event events[64];
+  ssize_t length;
+
+  // Only the last state in the batch matters
+  int state = -1;
+  while ((length = read(fd, events, sizeof(events))) > 0) {
+    for (size_t i = 0; i < length / sizeof(struct input_event); i++) {
+      if (events[i].type == EV_SW && events[i].code == SW_TABLET_MODE) {
+        state = events[i].value;
+      }
+    }
+  }
+  if (state != -1) {
+    switch_changed(state, switch_data);
+  }
+
+  if (condition & (G_IO_HUP | G_IO_ERR) || (length == -1 && errno == ENODEV)) {
+    g_print("Tablet mode switch went away\n");
+    switch_id = 0;
+    return G_SOURCE_REMOVE;
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+gboolean evdev_watch_switch(const gchar *device, evdev_switch_func changed,
+                            gpointer data) {
+  int fd = open_switch(device);
+  if (fd == -1) {
+    return FALSE;
+  }
+
+  char name[256] = "unknown";
+  ioctl(fd, EVIOCGNAME(sizeof(name)), name);
+  unsigned long state[NLONGS(SW_CNT)] = {0};
+  ioctl(fd, EVIOCGSW(sizeof(state)), state);
+  g_print("Watching tablet mode switch on %s (tablet mode: %d)\n", name,
+          test_bit(SW_TABLET_MODE, state));
+
+  switch_changed = changed;
+  switch_data = data;
+  switch_channel = g_io_channel_unix_new(fd);
+  g_io_channel_set_encoding(switch_channel, NULL, NULL);
+  g_io_channel_set_close_on_unref(switch_channel, TRUE);
+  switch_id = g_io_add_watch(switch_channel, G_IO_IN | G_IO_HUP | G_IO_ERR,
+                             switch_event, NULL);
+  return TRUE;
+}
+
+static void node_watch_free(gpointer data) {
+  node_watch_t *watch = data;
+  if (watch->destroy) {
+    watch->destroy(watch->data);
+  }
+  g_free(watch->devnode);
+  g_free(watch);
+}
+
+static gboolean node_event(GIOChannel *source, GIOCondition condition,
+                           gpointer data) {
+  node_watch_t *watch = data;
+  g_hash_table_remove(node_watches, watch->devnode);
+  watch->gone(watch->data);
+  return G_SOURCE_REMOVE;
+}
+
+void evdev_watch_node(const gchar *devnode, evdev_gone_func gone, gpointer data,
+                      GDestroyNotify destroy) {
+  if (!node_watches) {
+    node_watches = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  }
+  int fd = -1;
+  if (!g_hash_table_contains(node_watches, devnode)) {
+    fd = open(devnode, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  }
+  if (fd == -1) {
+    if (destroy) {
+      destroy(data);
+    }
+    return;
+  }
+
+  node_watch_t *watch = g_new0(node_watch_t, 1);
+  watch->devnode = g_strdup(devnode);
+  watch->gone = gone;
+  watch->data = data;
+  watch->destroy = destroy;
+
+  // G_IO_IN is left out, so pending key events never wake us
+  GIOChannel *channel = g_io_channel_unix_new(fd);
+  g_io_channel_set_close_on_unref(channel, TRUE);
+  guint id = g_io_add_watch_full(channel, G_PRIORITY_HIGH, G_IO_HUP | G_IO_ERR,
+                                 node_event, watch, node_watch_free);
+  g_io_channel_unref(channel);
+  g_hash_table_insert(node_watches, g_strdup(devnode), GUINT_TO_POINTER(id));
+}
+
+void evdev_cleanup(void) {
+  if (switch_id) {
+    g_source_remove(switch_id);
+    switch_id = 0;
+  }
+  g_clear_pointer(&switch_channel, g_io_channel_unref);
+
+  if (node_watches) {
+    GHashTableIter iter;
+    gpointer id;
+    g_hash_table_iter_init(&iter, node_watches);
+    while (g_hash_table_iter_next(&iter, NULL, &id)) {
+      g_source_remove(GPOINTER_TO_UINT(id));
+    }
+    g_clear_pointer(&node_watches, g_hash_table_destroy);
+  }
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <glib.h>
+
+typedef void (*evdev_switch_func)(gboolean tablet_mode, gpointer data);
+typedef void (*evdev_gone_func)(gpointer data);
+
+/**
+ * Watches an input device's SW_TABLET_MODE switch, calling changed on every
+ * change. device is an event node path, or "auto" to use the first node
+ * under /dev/input that has the switch. Any device reporting the switch
+ * works, including a uinput device replaying an evemu recording.
+ * @return FALSE if the device could not be opened or has no such switch.
+ */
+gboolean evdev_watch_switch(const gchar *device, evdev_switch_func changed,
+                            gpointer data);
+
+/**
+ * Watches an input event node for hangup, which the kernel signals as soon as
+ * the device is unregistered. Key events are not read, so typing does not
+ * wake the daemon. gone is called once with data, after which data is freed
+ * with destroy. Watching a node twice is a no-op.
+ */
+void evdev_watch_node(const gchar *devnode, evdev_gone_func gone, gpointer data,
+                      GDestroyNotify destroy);
+
+/** Stops every watch and closes the devices */
+void evdev_cleanup(void);
@@ -0,0 +1,253 @@
+#include "handoff.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "command.h"
+#include "display.h"
+#include "ipc.h"
+#include "state.h"
+
+#define STATE_MAX 1024
+
+static duet_context_t *handoff_context = NULL;
+static GSourceFunc handoff_done = NULL;
+static gpointer handoff_data = NULL;
+static gchar *handoff_path = NULL;
+static GIOChannel *handoff_channel = NULL;
+static guint handoff_watch_id = 0;
+// The command socket being handed over, -1 if there is none
+static int handoff_listen_fd = -1;
+// Set once this instance handed over, the newer one owns the socket file
+static gboolean handed_off = FALSE;
+
+static gchar *build_handoff_path(void) {
+  const gchar *runtime_dir = g_getenv("XDG_RUNTIME_DIR");
+  if (!runtime_dir) {
+    return NULL;
+  }
+  return g_build_filename(runtime_dir, "duet", "handoff.socket", NULL);
+}
+
+typedef struct {
+  handoff_received_func received;
+  gpointer data;
+  GIOChannel *channel;
+  guint watch_id;
+  guint timeout_id;
+  gint64 start;
+} receiver_t;
+
+// Ends the wait for the previous instance and reports what was received
+static void receiver_finish(receiver_t *receiver, int listen_fd,
+                            const duet_context_t *state, int layout) {
+  if (receiver->watch_id) {
+    g_source_remove(receiver->watch_id);
+  }
+  if (receiver->timeout_id) {
+    g_source_remove(receiver->timeout_id);
+  }
+  g_io_channel_unref(receiver->channel);
+  receiver->received(listen_fd, state, layout, receiver->data);
+  g_free(receiver);
+}
+
+static gboolean receive_timeout(gpointer data) {
+  receiver_t *receiver = data;
+  receiver->timeout_id = 0;
+  g_printerr("Previous duetd did not hand over its socket\n");
+  receiver_finish(receiver, -1, NULL, -1);
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean receive_ready(GIOChannel *source, GIOCondition condition,
+                              gpointer data) {
+  receiver_t *receiver = data;
+  receiver->watch_id = 0;
+
+  char buffer[STATE_MAX];
+  union {
+    struct cmsghdr header;
+    char buffer[CMSG_SPACE(sizeof(int))];
+  } control;
+  struct iovec iov = {.iov_base = buffer, .iov_len = sizeof(buffer)};
+  struct msghdr msg = {
+      .msg_iov = &iov,
+      .msg_iovlen = 1,
+      .msg_control = control.buffer,
+      .msg_controllen = sizeof(control.buffer),
+  };
+  ssize_t received;
+  do {
+    received = recvmsg(g_io_channel_unix_get_fd(source), &msg,
+                       MSG_CMSG_CLOEXEC | MSG_DONTWAIT);
+  } while (received == -1 && errno == EINTR);
+  if (received <= 0) {
+    g_printerr("Failed to receive handoff: %s\n",
+               received == 0 ? "connection closed" : g_strerror(errno));
+    receiver_finish(receiver, -1, NULL, -1);
+    return G_SOURCE_REMOVE;
+  }
+
+  int listen_fd = -1;
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+      cmsg->cmsg_type == SCM_RIGHTS &&
+      cmsg->cmsg_len == CMSG_LEN(sizeof(int))) {
+    memcpy(&listen_fd, CMSG_DATA(cmsg), sizeof(int));
+    // Layout commands are spawned from this process and must not inherit it
+    if (fcntl(listen_fd, F_SETFD, FD_CLOEXEC) == -1) {
+      perror("fcntl");
+    }
+  }
+
+  duet_context_t state = {0};
+  int layout = -1;
+  gboolean ok = state_from_data(buffer, received, &state, &layout);
+  if (!ok) {
+    g_printerr("Received invalid state from previous duetd\n");
+  }
+  g_print("Took over from previous duetd in %.1f ms\n",
+          (g_get_monotonic_time() - receiver->start) / 1000.0);
+  receiver_finish(receiver, listen_fd, ok ? &state : NULL, layout);
+  return G_SOURCE_REMOVE;
+}
+
+void handoff_receive(guint timeout_ms, handoff_received_func received,
+                     gpointer data) {
+  // Nothing listening means no previous instance, or one without handoff
+  gchar *path = build_handoff_path();
+  int fd = path ? ipc_connect(path, NULL) : -1;
+  g_free(path);
+  if (fd == -1) {
+    received(-1, NULL, -1, data);
+    return;
+  }
+
+  receiver_t *receiver = g_new0(receiver_t, 1);
+  receiver->received = received;
+  receiver->data = data;
+  receiver->start = g_get_monotonic_time();
+  receiver->channel = g_io_channel_unix_new(fd);
+  g_io_channel_set_close_on_unref(receiver->channel, TRUE);
+  receiver->watch_id =
+      g_io_add_watch(receiver->channel, G_IO_IN | G_IO_HUP | G_IO_ERR,
+                     receive_ready, receiver);
+  receiver->timeout_id = g_timeout_add(timeout_ms, receive_timeout, receiver);
+}
+
+// Sends the state and listening socket, once the last layout change is
+// applied and every reply the clients wait for is written
+static gboolean send_handoff(gpointer data) {
+  int client_fd = GPOINTER_TO_INT(data);
+
+  gsize length;
+  gchar *state = state_to_data(handoff_context,
+                               display_get_applied_layout(), &length);
+  union {
+    struct cmsghdr header;
+    char buffer[CMSG_SPACE(sizeof(int))];
+  } control;
+  memset(&control, 0, sizeof(control));
+  struct iovec iov = {.iov_base = state, .iov_len = length};
+  struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+
+  // Without a socket the new instance creates its own
+  if (handoff_listen_fd != -1) {
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &handoff_listen_fd, sizeof(int));
+  }
+
+  if (sendmsg(client_fd, &msg, MSG_NOSIGNAL) == -1) {
+    g_printerr("Failed to hand over: %s\n", g_strerror(errno));
+  } else {
+    g_print("Handed over to new duetd, stopping\n");
+  }
+  g_free(state);
+  close(client_fd);
+
+  handoff_done(handoff_data);
+  return G_SOURCE_REMOVE;
+}
+
+static void handoff_idle(int layout, gpointer data) {
+  command_when_drained(send_handoff, data);
+}
+
+static gboolean handoff_requested(GIOChannel *source, GIOCondition condition,
+                                  gpointer data) {
+  int client_fd = accept(g_io_channel_unix_get_fd(source), NULL, NULL);
+  if (client_fd == -1) {
+    perror("accept");
+    return G_SOURCE_CONTINUE;
+  }
+
+  // Only one takeover; the new instance now owns handoff.socket too
+  handed_off = TRUE;
+  handoff_watch_id = 0;
+  // New connections now queue up for the new instance
+  handoff_listen_fd = command_handoff();
+  display_when_idle(handoff_idle, GINT_TO_POINTER(client_fd));
+  return G_SOURCE_REMOVE;
+}
+
+void handoff_listen(duet_context_t *context, GSourceFunc done,
+                    gpointer data) {
+  handoff_context = context;
+  handoff_done = done;
+  handoff_data = data;
+  handoff_path = build_handoff_path();
+  if (!handoff_path) {
+    return;
+  }
+
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(handoff_path) >= sizeof(addr.sun_path)) {
+    g_printerr("Handoff socket path too long: %s\n", handoff_path);
+    return;
+  }
+  strncpy(addr.sun_path, handoff_path, sizeof(addr.sun_path) - 1);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    perror("socket");
+    return;
+  }
+  unlink(handoff_path);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+      listen(fd, 1) == -1) {
+    perror("handoff socket");
+    close(fd);
+    return;
+  }
+
+  handoff_channel = g_io_channel_unix_new(fd);
+  g_io_channel_set_close_on_unref(handoff_channel, TRUE);
+  handoff_watch_id =
+      g_io_add_watch(handoff_channel, G_IO_IN, handoff_requested, NULL);
+}
+
+void handoff_cleanup(void) {
+  if (handoff_watch_id) {
+    g_source_remove(handoff_watch_id);
+    handoff_watch_id = 0;
+  }
+  if (handoff_channel) {
+    g_io_channel_unref(handoff_channel);
+    handoff_channel = NULL;
+  }
+  if (handoff_path && !handed_off) {
+    unlink(handoff_path);
+  }
+  g_free(handoff_path);
+  handoff_path = NULL;
+}
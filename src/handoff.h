@@ -0,0 +1,35 @@
+#pragma once
+
+#include <glib.h>
+
+#include "context.h"
+
+/**
+ * Called with what a previous duetd handed over.
+ * @param listen_fd The received listening socket, or -1.
+ * @param state The previous instance's context, or NULL if none was received.
+ * @param layout The layout it had applied for that context, or -1.
+ */
+typedef void (*handoff_received_func)(int listen_fd,
+                                      const duet_context_t *state, int layout,
+                                      gpointer data);
+
+/**
+ * Asks a running duetd to hand over its command socket and state through
+ * $XDG_RUNTIME_DIR/duet/handoff.socket. The old instance stops accepting
+ * commands, finishes the layout change in flight and answers every client
+ * it accepted, sends the listening socket over SCM_RIGHTS and exits, so clients never see the
+ * socket missing during an upgrade. Does not block: received is called from
+ * the main loop, or right away if no duetd is running.
+ * @param timeout_ms Give up on the old instance after this long.
+ */
+void handoff_receive(guint timeout_ms, handoff_received_func received,
+                     gpointer data);
+
+/**
+ * Listens for a newer duetd asking to take over. Once the command socket and
+ * state were handed over, done is called with data to stop the daemon.
+ */
+void handoff_listen(duet_context_t *context, GSourceFunc done, gpointer data);
+
+void handoff_cleanup(void);
@@ -0,0 +1,247 @@
+#include "hyprland.h"
+
+#include <gio/gio.h>
+#include <json-glib/json-glib.h>
+
+#include "ipc.h"
+
+static gchar *command_socket = NULL;
+static guint event_watch = 0;
+static void (*events_changed)(gboolean closed) = NULL;
+
+// Resolves the path of one of Hyprland's sockets for the running instance.
+static gchar *socket_path(const gchar *name) {
+  const gchar *signature = g_getenv("HYPRLAND_INSTANCE_SIGNATURE");
+  if (!signature) {
+    return NULL;
+  }
+
+  const gchar *runtime_dir = g_getenv("XDG_RUNTIME_DIR");
+  if (runtime_dir) {
+    gchar *path = g_build_filename(runtime_dir, "hypr", signature, name, NULL);
+    if (g_file_test(path, G_FILE_TEST_EXISTS)) {
+      return path;
+    }
+    g_free(path);
+  }
+
+  // Hyprland before 0.40 kept its sockets in /tmp
+  return g_build_filename("/tmp/hypr", signature, name, NULL);
+}
+
+static void hyprland_init(void) {
+  g_free(command_socket);
+  command_socket = socket_path(".socket.sock");
+}
+
+static gboolean hyprland_available(void) {
+  return command_socket && g_file_test(command_socket, G_FILE_TEST_EXISTS);
+}
+
+static const char *placement_position(int placement) {
+  switch (placement) {
+  case PLACEMENT_BELOW:
+    return "auto-down";
+  case PLACEMENT_LEFT:
+    return "auto-left";
+  case PLACEMENT_RIGHT:
+    return "auto-right";
+  default:
+    return "auto";
+  }
+}
+
+// Builds the `monitor` keyword value for an output.
+static gchar *monitor_rule(const display_output_t *output,
+                           const display_output_t *primary) {
+  if (!output->enabled) {
+    return g_strdup_printf("%s,disable", output->name);
+  }
+  if (output->mirror) {
+    return g_strdup_printf("%s,preferred,auto,auto,mirror,%s", output->name,
+                           primary->name);
+  }
+  return g_strdup_printf("%s,preferred,%s,auto,transform,%d", output->name,
+                         placement_position(output->placement),
+                         output->transform / 90);
+}
+
+// Checks a [[BATCH]] reply, which is the replies of the commands run
+// together, "okok" for two that succeeded. Whitespace is ignored.
+static gboolean batch_ok(const gchar *reply, guint commands) {
+  GString *replies = g_string_new(NULL);
+  for (const gchar *c = reply; *c; c++) {
+    if (!g_ascii_isspace(*c)) {
+      g_string_append_c(replies, *c);
+    }
+  }
+  gboolean ok = replies->len == commands * 2;
+  for (guint i = 0; ok && i < commands; i++) {
+    ok = replies->str[i * 2] == 'o' && replies->str[i * 2 + 1] == 'k';
+  }
+  g_string_free(replies, TRUE);
+  return ok;
+}
+
+static gboolean hyprland_apply(const display_layout_t *layout,
+                               GCancellable *cancellable, GError **error) {
+  if (!hyprland_available()) {
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                "Hyprland command socket not found");
+    return FALSE;
+  }
+
+  // Send the changed monitor rules as one batch so Hyprland reconfigures
+  // once.
+  GString *request = g_string_new("[[BATCH]]");
+  guint commands = 0;
+  const display_output_t *outputs[] = {&layout->primary, &layout->secondary};
+  for (gsize i = 0; i < G_N_ELEMENTS(outputs); i++) {
+    if (!outputs[i]->changes) {
+      continue;
+    }
+    gchar *rule = monitor_rule(outputs[i], &layout->primary);
+    g_string_append_printf(request, "%skeyword monitor %s",
+                           commands ? ";" : "", rule);
+    g_free(rule);
+    commands++;
+  }
+  if (!commands) {
+    g_string_free(request, TRUE);
+    return TRUE;
+  }
+
+  gchar *reply =
+      ipc_request(command_socket, request->str, FALSE, cancellable, error);
+  gboolean ok = reply != NULL;
+  if (ok && !batch_ok(reply, commands)) {
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                "Hyprland rejected %s: %s", request->str, g_strstrip(reply));
+    ok = FALSE;
+  }
+  g_free(reply);
+  g_string_free(request, TRUE);
+  return ok;
+}
+
+// Fills in state from the reply to `j/monitors all`.
+static gboolean parse_monitors(const gchar *reply, display_state_t *state,
+                               GError **error) {
+  JsonParser *parser = json_parser_new();
+  if (!json_parser_load_from_data(parser, reply, -1, error)) {
+    g_object_unref(parser);
+    return FALSE;
+  }
+
+  JsonNode *root = json_parser_get_root(parser);
+  if (!root || !JSON_NODE_HOLDS_ARRAY(root)) {
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                "Unexpected Hyprland monitors reply");
+    g_object_unref(parser);
+    return FALSE;
+  }
+
+  JsonArray *monitors = json_node_get_array(root);
+  for (guint i = 0; i < json_array_get_length(monitors); i++) {
+    JsonObject *monitor = json_array_get_object_element(monitors, i);
+    if (!monitor) {
+      continue;
+    }
+    display_output_state_t *output = display_state_lookup(
+        state, json_object_get_string_member_with_default(monitor, "name", ""));
+    if (!output) {
+      continue;
+    }
+
+    // Hyprland reports the mode in pixels; convert it to the logical size.
+    gdouble scale =
+        json_object_get_double_member_with_default(monitor, "scale", 1.0);
+    int transform =
+        json_object_get_int_member_with_default(monitor, "transform", 0);
+    int width = json_object_get_int_member_with_default(monitor, "width", 0);
+    int height = json_object_get_int_member_with_default(monitor, "height", 0);
+    if (scale <= 0) {
+      scale = 1.0;
+    }
+
+    output->present = TRUE;
+    output->enabled =
+        !json_object_get_boolean_member_with_default(monitor, "disabled", FALSE);
+    output->transform = (transform % 4) * 90;
+    output->x = json_object_get_int_member_with_default(monitor, "x", 0);
+    output->y = json_object_get_int_member_with_default(monitor, "y", 0);
+    output->width = (transform % 2 ? height : width) / scale;
+    output->height = (transform % 2 ? width : height) / scale;
+    output->mirror = !g_str_equal(
+        json_object_get_string_member_with_default(monitor, "mirrorOf", "none"),
+        "none");
+  }
+
+  g_object_unref(parser);
+  return TRUE;
+}
+
+static gboolean hyprland_query(display_state_t *state,
+                               GCancellable *cancellable, GError **error) {
+  if (!hyprland_available()) {
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                "Hyprland command socket not found");
+    return FALSE;
+  }
+
+  gchar *reply = ipc_request(command_socket, "j/monitors all", FALSE,
+                             cancellable, error);
+  if (!reply) {
+    return FALSE;
+  }
+  gboolean ok = parse_monitors(reply, state, error);
+  g_free(reply);
+  return ok;
+}
+
+static void event_line(const gchar *line, gpointer data) {
+  // Hyprland has no event for monitor rule changes; monitors being added,
+  // removed or reconfigured show up as these.
+  if (g_str_has_prefix(line, "monitoradded") ||
+      g_str_has_prefix(line, "monitorremoved") ||
+      g_str_has_prefix(line, "configreloaded>>")) {
+    events_changed(FALSE);
+  }
+}
+
+static void event_closed(gpointer data) {
+  event_watch = 0;
+  events_changed(TRUE);
+}
+
+static gboolean hyprland_subscribe(void (*changed)(gboolean closed),
+                                   GError **error) {
+  gchar *path = socket_path(".socket2.sock");
+  if (!path) {
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                "HYPRLAND_INSTANCE_SIGNATURE is not set");
+    return FALSE;
+  }
+
+  events_changed = changed;
+  event_watch =
+      ipc_subscribe(path, NULL, event_line, event_closed, NULL, error);
+  g_free(path);
+  return event_watch != 0;
+}
+
+static void hyprland_unsubscribe(void) {
+  ipc_unsubscribe(event_watch);
+  event_watch = 0;
+}
+
+const display_backend_t hyprland_backend = {
+    .name = "hyprland",
+    .init = hyprland_init,
+    .available = hyprland_available,
+    .mirrors = TRUE,
+    .apply = hyprland_apply,
+    .query = hyprland_query,
+    .subscribe = hyprland_subscribe,
+    .unsubscribe = hyprland_unsubscribe,
+};
@@ -0,0 +1,6 @@
+#pragma once
+
+#include "display.h"
+
+/** Display backend talking to Hyprland over its command socket */
+extern const display_backend_t hyprland_backend;
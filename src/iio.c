@@ -0,0 +1,230 @@
+#include "iio.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Below this share of gravity in the screen plane the device is lying flat
+// and the in-plane angle is noise
+#define FLAT_RATIO 0.5
+
+static const gchar *const orientation_names[] = {"normal", "left-up",
+                                                 "bottom-up", "right-up"};
+
+static const duet_config_t *config;
+static iio_orientation_func on_changed;
+static gpointer on_changed_data;
+static guint poll_id;
+static int axis_fds[3] = {-1, -1, -1};
+static double mount_matrix[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+/** Index into orientation_names, -1 before the first reading */
+static int current = -1;
+/** When readings first left the current orientation's sector, or 0 */
+static gint64 left_at;
+/** Accelerometer reads and time spent polling */
+static guint64 reads;
+static gint64 active_since;
+static gint64 active_total;
+
+// Returns the path of the first IIO device under root with an accelerometer
+static gchar *find_accelerometer(const gchar *root) {
+  GError *error = NULL;
+  GDir *dir = g_dir_open(root, 0, &error);
+  if (!dir) {
+    g_printerr("Failed to open %s: %s\n", root, error->message);
+    g_error_free(error);
+    return NULL;
+  }
+
+  gchar *device = NULL;
+  const gchar *name;
+  while (!device && (name = g_dir_read_name(dir))) {
+    if (!g_str_has_prefix(name, "iio:device")) {
+      continue;
+    }
+    gchar *path = g_build_filename(root, name, "in_accel_x_raw", NULL);
+    if (g_file_test(path, G_FILE_TEST_EXISTS)) {
+      device = g_build_filename(root, name, NULL);
+    }
+    g_free(path);
+  }
+  g_dir_close(dir);
+  return device;
+}
+
+// Reads the mount matrix the kernel reports for the sensor, if any, so
+// readings are in the display's frame like iio-sensor-proxy's
+static void read_mount_matrix(const gchar *device) {
+  const gchar *const names[] = {"in_accel_mount_matrix", "mount_matrix"};
+  for (guint i = 0; i < G_N_ELEMENTS(names); i++) {
+    gchar *path = g_build_filename(device, names[i], NULL);
+    gchar *contents = NULL;
+    double m[3][3];
+    gboolean parsed =
+        g_file_get_contents(path, &contents, NULL, NULL) &&
+        sscanf(contents, "%lf, %lf, %lf; %lf, %lf, %lf; %lf, %lf, %lf",
+               &m[0][0], &m[0][1], &m[0][2], &m[1][0], &m[1][1], &m[1][2],
+               &m[2][0], &m[2][1], &m[2][2]) == 9;
+    g_free(contents);
+    g_free(path);
+    if (parsed) {
+      memcpy(mount_matrix, m, sizeof(m));
+      return;
+    }
+  }
+}
+
+static gboolean read_axis(int fd, double *value) {
+  char buffer[32];
+  ssize_t length = pread(fd, buffer, sizeof(buffer) - 1, 0);
+  if (length <= 0) {
+    return FALSE;
+  }
+  buffer[length] = '\0';
+
+  char *end;
+  long raw = strtol(buffer, &end, 10);
+  if (end == buffer) {
+    return FALSE;
+  }
+  *value = raw;
+  return TRUE;
+}
+
+// Reads the accelerometer and reports the orientation once the reading is
+// more than HYSTERESIS_DEGREES past the boundary of the current one
+static gboolean poll_accelerometer(gpointer data) {
+  reads++;
+  double raw[3] = {0, 0, 0};
+  for (int axis = 0; axis < 3; axis++) {
+    if (axis_fds[axis] != -1 && !read_axis(axis_fds[axis], &raw[axis])) {
+      return G_SOURCE_CONTINUE;
+    }
+  }
+
+  double v[3];
+  for (int row = 0; row < 3; row++) {
+    v[row] = mount_matrix[row][0] * raw[0] + mount_matrix[row][1] * raw[1] +
+             mount_matrix[row][2] * raw[2];
+  }
+
+  double plane = hypot(v[0], v[1]);
+  double total = sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+  if (total == 0 || plane < total * FLAT_RATIO) {
+    left_at = 0;
+    return G_SOURCE_CONTINUE;
+  }
+
+  // Clockwise angle of the top edge from upright, matching iio-sensor-proxy:
+  // gravity along -y is normal and along +x is left-up
+  double angle = atan2(v[0], -v[1]) * 180 / G_PI;
+  if (angle < 0) {
+    angle += 360;
+  }
+  int nearest = (int)((angle + 45) / 90) % 4;
+
+  if (current == -1) {
+    current = nearest;
+    on_changed(orientation_names[current], on_changed_data);
+    return G_SOURCE_CONTINUE;
+  }
+  if (nearest == current) {
+    left_at = 0;
+    return G_SOURCE_CONTINUE;
+  }
+
+  gint64 now = g_get_monotonic_time();
+  if (!left_at) {
+    left_at = now;
+  }
+  double distance = fabs(remainder(angle - current * 90, 360));
+  if (distance < 45 + config->rotation_hysteresis) {
+    return G_SOURCE_CONTINUE;
+  }
+
+  g_print("Accelerometer orientation %s detected %.1f ms after leaving %s\n",
+          orientation_names[nearest], (now - left_at) / 1000.0,
+          orientation_names[current]);
+  current = nearest;
+  left_at = 0;
+  on_changed(orientation_names[current], on_changed_data);
+  return G_SOURCE_CONTINUE;
+}
+
+gboolean iio_watch(const duet_config_t *cfg, iio_orientation_func changed,
+                   gpointer data) {
+  config = cfg;
+  gchar *device = find_accelerometer(config->iio_device_root);
+  if (!device) {
+    g_printerr("No accelerometer found in %s\n", config->iio_device_root);
+    return FALSE;
+  }
+
+  const gchar *const axes[] = {"in_accel_x_raw", "in_accel_y_raw",
+                               "in_accel_z_raw"};
+  for (int axis = 0; axis < 3; axis++) {
+    gchar *path = g_build_filename(device, axes[axis], NULL);
+    axis_fds[axis] = open(path, O_RDONLY | O_CLOEXEC);
+    // z only tells whether the device is lying flat, so it is optional
+    if (axis_fds[axis] == -1 && axis < 2) {
+      g_printerr("Failed to open %s: %s\n", path, g_strerror(errno));
+      g_free(path);
+      g_free(device);
+      iio_cleanup();
+      return FALSE;
+    }
+    g_free(path);
+  }
+  read_mount_matrix(device);
+
+  on_changed = changed;
+  on_changed_data = data;
+  g_print("Reading accelerometer %s every %d ms\n", device,
+          config->rotation_poll_ms);
+  g_free(device);
+  iio_set_active(TRUE);
+  return TRUE;
+}
+
+void iio_set_active(gboolean active) {
+  if (axis_fds[0] == -1 || active == (poll_id != 0)) {
+    return;
+  }
+
+  gint64 now = g_get_monotonic_time();
+  if (active) {
+    active_since = now;
+    poll_id = g_timeout_add(config->rotation_poll_ms, poll_accelerometer, NULL);
+    // Report the current orientation without waiting for the first tick
+    current = -1;
+    left_at = 0;
+    poll_accelerometer(NULL);
+  } else {
+    active_total += now - active_since;
+    g_source_remove(poll_id);
+    poll_id = 0;
+  }
+}
+
+guint64 iio_get_reads(void) { return reads; }
+
+gint64 iio_get_active_time(void) {
+  return poll_id ? active_total + g_get_monotonic_time() - active_since
+                 : active_total;
+}
+
+void iio_cleanup(void) {
+  iio_set_active(FALSE);
+  for (int axis = 0; axis < 3; axis++) {
+    if (axis_fds[axis] != -1) {
+      close(axis_fds[axis]);
+      axis_fds[axis] = -1;
+    }
+  }
+  current = -1;
+  left_at = 0;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <glib.h>
+
+#include "config.h"
+
+typedef void (*iio_orientation_func)(const gchar *orientation, gpointer data);
+
+/**
+ * Starts polling the first accelerometer found under the configured
+ * IIO_DEVICE_ROOT, calling changed with an iio-sensor-proxy style orientation
+ * name ("normal", "left-up", "right-up" or "bottom-up") for the first reading
+ * and for every change after it.
+ * @return FALSE if no usable accelerometer was found.
+ */
+gboolean iio_watch(const duet_config_t *config, iio_orientation_func changed,
+                   gpointer data);
+
+/**
+ * Pauses or resumes polling. Resuming reports the current orientation right
+ * away, even if it did not change.
+ */
+void iio_set_active(gboolean active);
+
+/** The number of accelerometer reads so far */
+guint64 iio_get_reads(void);
+
+/** Microseconds spent polling so far */
+gint64 iio_get_active_time(void);
+
+/** Stops polling and closes the accelerometer */
+void iio_cleanup(void);
@@ -0,0 +1,233 @@
+#include "ipc.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static void set_errno_error(GError **error, int err, const gchar *what) {
+  g_set_error(error, G_IO_ERROR, g_io_error_from_errno(err), "%s: %s", what,
+              g_strerror(err));
+}
+
+// Waits until fd is ready for events or cancellable is cancelled.
+static gboolean wait_fd(int fd, short events, GCancellable *cancellable,
+                        GError **error) {
+  struct pollfd fds[2] = {
+      {.fd = fd, .events = events},
+      {.fd = g_cancellable_get_fd(cancellable), .events = POLLIN},
+  };
+  nfds_t nfds = fds[1].fd == -1 ? 1 : 2;
+
+  int ret;
+  do {
+    ret = poll(fds, nfds, -1);
+  } while (ret == -1 && errno == EINTR);
+
+  if (nfds == 2) {
+    g_cancellable_release_fd(cancellable);
+  }
+  if (ret == -1) {
+    set_errno_error(error, errno, "poll");
+    return FALSE;
+  }
+  return !g_cancellable_set_error_if_cancelled(cancellable, error);
+}
+
+int ipc_connect(const gchar *path, GError **error) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                "Socket path too long: %s", path);
+    return -1;
+  }
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    set_errno_error(error, errno, "socket");
+    return -1;
+  }
+
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    set_errno_error(error, errno, path);
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+// Writes all of request to fd.
+static gboolean send_all(int fd, const gchar *request,
+                         GCancellable *cancellable, GError **error) {
+  size_t len = strlen(request);
+  size_t total_sent = 0;
+  while (total_sent < len) {
+    if (!wait_fd(fd, POLLOUT, cancellable, error)) {
+      return FALSE;
+    }
+    ssize_t sent = send(fd, request + total_sent, len - total_sent,
+                        MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (sent == -1) {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+      set_errno_error(error, errno, "send");
+      return FALSE;
+    }
+    total_sent += sent;
+  }
+  return TRUE;
+}
+
+// Reads a reply from fd until EOF or, if line_reply is set, a newline.
+static gchar *receive_reply(int fd, gboolean line_reply,
+                            GCancellable *cancellable, GError **error) {
+  GString *reply = g_string_new(NULL);
+  char buffer[4096];
+  for (;;) {
+    if (!wait_fd(fd, POLLIN, cancellable, error)) {
+      g_string_free(reply, TRUE);
+      return NULL;
+    }
+    ssize_t received = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (received == -1) {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+      set_errno_error(error, errno, "recv");
+      g_string_free(reply, TRUE);
+      return NULL;
+    }
+    if (received == 0) {
+      break;
+    }
+    g_string_append_len(reply, buffer, received);
+    if (line_reply && memchr(buffer, '\n', received)) {
+      break;
+    }
+  }
+  return g_string_free(reply, FALSE);
+}
+
+gchar *ipc_request(const gchar *path, const gchar *request,
+                   gboolean line_reply, GCancellable *cancellable,
+                   GError **error) {
+  int fd = ipc_connect(path, error);
+  if (fd == -1) {
+    return NULL;
+  }
+
+  gchar *reply = NULL;
+  if (send_all(fd, request, cancellable, error)) {
+    reply = receive_reply(fd, line_reply, cancellable, error);
+  }
+  close(fd);
+  return reply;
+}
+
+gchar **ipc_request_all(const gchar *path, const gchar *const *requests,
+                        gboolean line_reply, GCancellable *cancellable,
+                        GError **error) {
+  guint count = g_strv_length((gchar **)requests);
+  int *fds = g_new(int, count);
+  gchar **replies = g_new0(gchar *, count + 1);
+  guint connected = 0;
+  gboolean ok = TRUE;
+
+  while (ok && connected < count) {
+    int fd = ipc_connect(path, error);
+    if (fd == -1) {
+      ok = FALSE;
+      break;
+    }
+    fds[connected] = fd;
+    ok = send_all(fd, requests[connected], cancellable, error);
+    connected++;
+  }
+
+  for (guint i = 0; i < count && ok; i++) {
+    replies[i] = receive_reply(fds[i], line_reply, cancellable, error);
+    ok = replies[i] != NULL;
+  }
+
+  for (guint i = 0; i < connected; i++) {
+    close(fds[i]);
+  }
+  g_free(fds);
+
+  if (!ok) {
+    g_strfreev(replies);
+    return NULL;
+  }
+  return replies;
+}
+
+typedef struct {
+  GIOChannel *channel;
+  ipc_line_func on_line;
+  ipc_closed_func on_closed;
+  gpointer data;
+} subscription_t;
+
+static void subscription_free(gpointer data) {
+  subscription_t *subscription = data;
+  g_io_channel_unref(subscription->channel);
+  g_free(subscription);
+}
+
+static gboolean subscription_event(GIOChannel *source, GIOCondition condition,
+                                   gpointer data) {
+  subscription_t *subscription = data;
+  gchar *line = NULL;
+  gsize terminator = 0;
+  GIOStatus status;
+
+  // Drain every complete line; a partial line stays buffered in the channel
+  while ((status = g_io_channel_read_line(source, &line, NULL, &terminator,
+                                          NULL)) == G_IO_STATUS_NORMAL) {
+    line[terminator] = '\0';
+    subscription->on_line(line, subscription->data);
+    g_free(line);
+  }
+
+  if (status == G_IO_STATUS_EOF || status == G_IO_STATUS_ERROR ||
+      (condition & (G_IO_HUP | G_IO_ERR))) {
+    subscription->on_closed(subscription->data);
+    return G_SOURCE_REMOVE;
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+guint ipc_subscribe(const gchar *path, const gchar *request,
+                    ipc_line_func on_line, ipc_closed_func on_closed,
+                    gpointer data, GError **error) {
+  int fd = ipc_connect(path, error);
+  if (fd == -1) {
+    return 0;
+  }
+  if (request && !send_all(fd, request, NULL, error)) {
+    close(fd);
+    return 0;
+  }
+
+  subscription_t *subscription = g_new0(subscription_t, 1);
+  subscription->channel = g_io_channel_unix_new(fd);
+  subscription->on_line = on_line;
+  subscription->on_closed = on_closed;
+  subscription->data = data;
+  g_io_channel_set_encoding(subscription->channel, NULL, NULL);
+  g_io_channel_set_flags(subscription->channel, G_IO_FLAG_NONBLOCK, NULL);
+  g_io_channel_set_close_on_unref(subscription->channel, TRUE);
+
+  return g_io_add_watch_full(subscription->channel, G_PRIORITY_DEFAULT,
+                             G_IO_IN | G_IO_HUP | G_IO_ERR, subscription_event,
+                             subscription, subscription_free);
+}
+
+void ipc_unsubscribe(guint id) {
+  if (id) {
+    g_source_remove(id);
+  }
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <gio/gio.h>
+#include <glib.h>
+
+/**
+ * Connects to the UNIX stream socket at path.
+ * @return The connected fd, or -1 with error set.
+ */
+int ipc_connect(const gchar *path, GError **error);
+
+/**
+ * Sends a single request over a fresh connection to the socket at path and
+ * reads the reply until the peer closes the connection or, if
+ * line_reply is set, until the first newline. Blocks the calling thread,
+ * but returns early with G_IO_ERROR_CANCELLED once cancellable is cancelled.
+ * @return The newly allocated reply, or NULL with error set.
+ */
+gchar *ipc_request(const gchar *path, const gchar *request,
+                   gboolean line_reply, GCancellable *cancellable,
+                   GError **error);
+
+/**
+ * Sends each request over its own connection to the socket at path. All
+ * requests are written before any reply is read, so the peer can handle them
+ * together. Replies are read as in ipc_request().
+ * @return A newly allocated NULL terminated array with one reply per request,
+ * or NULL with error set.
+ */
+gchar **ipc_request_all(const gchar *path, const gchar *const *requests,
+                        gboolean line_reply, GCancellable *cancellable,
+                        GError **error);
+
+typedef void (*ipc_line_func)(const gchar *line, gpointer data);
+typedef void (*ipc_closed_func)(gpointer data);
+
+/**
+ * Connects to the socket at path, sends request if not NULL, and then watches
+ * the connection on the main loop, calling on_line for each line received
+ * and on_closed once the peer closes the connection.
+ * @return The watch source id, or 0 with error set.
+ */
+guint ipc_subscribe(const gchar *path, const gchar *request,
+                    ipc_line_func on_line, ipc_closed_func on_closed,
+                    gpointer data, GError **error);
+
+/** Stops a watch started with ipc_subscribe() and closes its connection */
+void ipc_unsubscribe(guint id);
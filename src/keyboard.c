@@ -5,9 +5,12 @@
 #include <libudev.h>
 
 #include "display.h"
+#include "evdev.h"
+#include "rotation.h"
+#include "trace.h"
 
-const char *keyboardVendorId = "0b05";
-const char *keyboardProductId = "1b2c";
+// How long USB gets to confirm a detach reported early by the input layer
+#define USB_CONFIRM_MS 2000
 
 typedef struct {
   char *devpath;
@@ -17,9 +20,24 @@ typedef struct {
 
 typedef struct {
   struct udev_monitor *monitor;
+  /** Input node events for WATCH_INPUT_NODES, not filtered by UDEV_TAG */
+  struct udev_monitor *input_monitor;
+  GIOChannel *input_channel;
+  guint input_watch_id;
   struct udev *udev_ctx;
   GHashTable *devices;
+  /**
+   * Devpaths removed while the startup enumeration runs, which its snapshot
+   * may still list. NULL once it finished.
+   */
+  GHashTable *removed;
   duet_context_t *context;
+  const duet_config_t *config;
+  /** Pending check that USB confirms an early detach */
+  guint confirm_id;
+  /** When and how an early detach was detected, 0 if there was none */
+  gint64 early_at;
+  const char *early_source;
 } keyboard_context_t;
 
 static keyboard_context_t kb_context;
@@ -32,11 +50,125 @@ static void free_device_info(gpointer data) {
   g_free(info);
 }
 
-static gboolean is_target_device(struct udev_device *dev) {
-  const char *vendor = udev_device_get_sysattr_value(dev, "idVendor");
-  const char *product = udev_device_get_sysattr_value(dev, "idProduct");
-  return (vendor && product && g_str_equal(vendor, keyboardVendorId) &&
-          g_str_equal(product, keyboardProductId));
+// Matches a device against the configured rules. Uses the ids udev already
+// put in the event's properties, so no sysfs reads are needed.
+static gboolean is_target_device(const duet_config_t *config,
+                                 struct udev_device *dev) {
+  const char *vendor = udev_device_get_property_value(dev, "ID_VENDOR_ID");
+  const char *product = udev_device_get_property_value(dev, "ID_MODEL_ID");
+  if (!vendor || !product) {
+    return FALSE;
+  }
+  for (guint i = 0; i < config->n_keyboard_devices; i++) {
+    const duet_device_rule_t *rule = &config->keyboard_devices[i];
+    if (g_str_equal(vendor, rule->vendor_id) &&
+        g_str_equal(product, rule->product_id)) {
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+static device_info_t *add_device(keyboard_context_t *context,
+                                 struct udev_device *dev) {
+  device_info_t *info = g_new0(device_info_t, 1);
+  info->devpath = g_strdup(udev_device_get_devpath(dev));
+  info->vendor_id =
+      g_strdup(udev_device_get_property_value(dev, "ID_VENDOR_ID"));
+  info->product_id =
+      g_strdup(udev_device_get_property_value(dev, "ID_MODEL_ID"));
+  // Replace rather than insert, the key belongs to the value
+  g_hash_table_replace(context->devices, info->devpath, info);
+  return info;
+}
+
+static void set_connected(keyboard_context_t *context, gboolean connected,
+                          guint trace_id) {
+  context->context->keyboardConnected = connected;
+  rotation_set_needed(!connected);
+  // Detach is applied immediately, attach may settle with rotation
+  display_schedule_layout(context->context, !connected, trace_id);
+}
+
+static void cancel_confirm(keyboard_context_t *context) {
+  if (context->confirm_id) {
+    g_source_remove(context->confirm_id);
+    context->confirm_id = 0;
+  }
+  context->early_at = 0;
+}
+
+// USB is the source of truth, undo an early detach it did not confirm
+static gboolean confirm_detach(gpointer data) {
+  keyboard_context_t *context = data;
+  context->confirm_id = 0;
+  context->early_at = 0;
+  if (g_hash_table_size(context->devices) > 0 &&
+      !context->context->keyboardConnected) {
+    g_print("Keyboard still on USB, reverting early detach\n");
+    set_connected(context, TRUE, 0);
+  }
+  return G_SOURCE_REMOVE;
+}
+
+static void early_detach(keyboard_context_t *context, const char *source,
+                         guint trace_id) {
+  if (!context->context->keyboardConnected) {
+    return;
+  }
+  g_print("Keyboard detach detected early via %s\n", source);
+  cancel_confirm(context);
+  context->early_at = g_get_monotonic_time();
+  context->early_source = source;
+  context->confirm_id = g_timeout_add(USB_CONFIRM_MS, confirm_detach, context);
+  set_connected(context, FALSE, trace_id);
+}
+
+static void switch_changed(gboolean tablet_mode, gpointer data) {
+  keyboard_context_t *context = data;
+  guint trace_id = trace_event("tablet mode switch");
+  if (tablet_mode) {
+    early_detach(context, "tablet mode switch", trace_id);
+  } else if (g_hash_table_size(context->devices) > 0 &&
+             !context->context->keyboardConnected) {
+    g_print("Tablet mode off with the keyboard still on USB, reattaching\n");
+    cancel_confirm(context);
+    set_connected(context, TRUE, trace_id);
+  }
+}
+
+static void input_node_gone(gpointer data) {
+  early_detach(data, "input node hangup", trace_event("input node hangup"));
+}
+
+static void watch_input_node(const char *devnode) {
+  if (devnode && g_str_has_prefix(devnode, "/dev/input/event")) {
+    evdev_watch_node(devnode, input_node_gone, &kb_context, NULL);
+  }
+}
+
+// An input device was added; watch it if it belongs to a connected keyboard
+static void input_added(keyboard_context_t *context, struct udev_device *dev) {
+  struct udev_device *usb_dev =
+      udev_device_get_parent_with_subsystem_devtype(dev, "usb", "usb_device");
+  if (usb_dev && g_hash_table_contains(context->devices,
+                                       udev_device_get_devpath(usb_dev))) {
+    watch_input_node(udev_device_get_devnode(dev));
+  }
+}
+
+static gboolean input_event(GIOChannel *source, GIOCondition condition,
+                            gpointer data) {
+  keyboard_context_t *context = data;
+  struct udev_device *dev =
+      udev_monitor_receive_device(context->input_monitor);
+  if (dev) {
+    if (g_strcmp0(udev_device_get_action(dev), "add") == 0) {
+      input_added(context, dev);
+    }
+    udev_device_unref(dev);
+  }
+  return G_SOURCE_CONTINUE;
 }
 
 static gboolean udev_event(GIOChannel *source, GIOCondition condition,
@@ -49,29 +181,42 @@ static gboolean udev_event(GIOChannel *source, GIOCondition condition,
     const char *devpath = udev_device_get_devpath(dev);
 
     if (action && devpath) {
-      if (g_str_equal(action, "add") && is_target_device(dev)) {
+      if (g_str_equal(action, "add") &&
+          is_target_device(context->config, dev)) {
+        guint trace_id = trace_event("keyboard udev");
+        if (context->removed) {
+          g_hash_table_remove(context->removed, devpath);
+        }
         // Store device details
-        device_info_t *info = g_new0(device_info_t, 1);
-        info->devpath = g_strdup(devpath);
-        info->vendor_id =
-            g_strdup(udev_device_get_sysattr_value(dev, "idVendor"));
-        info->product_id =
-            g_strdup(udev_device_get_sysattr_value(dev, "idProduct"));
-        g_hash_table_insert(context->devices, info->devpath, info);
+        device_info_t *info = add_device(context, dev);
 
         g_print("Keyboard CONNECTED: %s (Vendor: %s, Product: %s)\n", devpath,
                 info->vendor_id, info->product_id);
-        context->context->keyboardConnected = TRUE;
-        setLayout(context->context);
+        cancel_confirm(context);
+        set_connected(context, TRUE, trace_id);
       } else if (g_str_equal(action, "remove")) {
+        if (context->removed) {
+          g_hash_table_add(context->removed, g_strdup(devpath));
+        }
         // Retrieve stored details
         device_info_t *info = g_hash_table_lookup(context->devices, devpath);
         if (info) {
+          guint trace_id = trace_event("keyboard udev");
           g_print("Keyboard DISCONNECTED: %s (Vendor: %s, Product: %s)\n",
                   devpath, info->vendor_id, info->product_id);
           g_hash_table_remove(context->devices, devpath);
-          context->context->keyboardConnected = FALSE;
-          setLayout(context->context);
+          // Another configured keyboard may still be attached
+          if (g_hash_table_size(context->devices) == 0) {
+            if (context->early_at) {
+              g_print("USB confirmed detach %.1f ms after the %s\n",
+                      (g_get_monotonic_time() - context->early_at) / 1000.0,
+                      context->early_source);
+            }
+            cancel_confirm(context);
+            if (context->context->keyboardConnected) {
+              set_connected(context, FALSE, trace_id);
+            }
+          }
         }
       }
     }
@@ -81,54 +226,143 @@ static gboolean udev_event(GIOChannel *source, GIOCondition condition,
   return G_SOURCE_CONTINUE;
 }
 
-// Check for existing devices on startup
-static void check_initial_devices(keyboard_context_t *context) {
-  struct udev_enumerate *enumerate = udev_enumerate_new(context->udev_ctx);
-  udev_enumerate_add_match_subsystem(enumerate, "usb");
-  udev_enumerate_add_match_property(enumerate, "DEVTYPE", "usb_device");
+// A keyboard found by the startup enumeration
+typedef struct {
+  device_info_t *info;
+  /** Its input event nodes, if WATCH_INPUT_NODES is set */
+  GPtrArray *devnodes;
+} found_device_t;
+
+static void found_device_free(gpointer data) {
+  found_device_t *found = data;
+  if (found->info) {
+    free_device_info(found->info);
+  }
+  g_ptr_array_unref(found->devnodes);
+  g_free(found);
+}
+
+static void find_input_nodes(struct udev *udev_ctx, struct udev_device *usb_dev,
+                             GPtrArray *devnodes) {
+  struct udev_enumerate *enumerate = udev_enumerate_new(udev_ctx);
+  udev_enumerate_add_match_subsystem(enumerate, "input");
+  udev_enumerate_add_match_parent(enumerate, usb_dev);
   udev_enumerate_scan_devices(enumerate);
 
-  struct udev_list_entry *devices = udev_enumerate_get_list_entry(enumerate);
   struct udev_list_entry *entry;
-
-  int connected = FALSE;
-
-  udev_list_entry_foreach(entry, devices) {
-    const char *path = udev_list_entry_get_name(entry);
-    struct udev_device *dev =
-        udev_device_new_from_syspath(context->udev_ctx, path);
-
-    if (is_target_device(dev)) {
-      const char *devpath = udev_device_get_devpath(dev);
-      device_info_t *info = g_new0(device_info_t, 1);
-      info->devpath = g_strdup(devpath);
-      info->vendor_id =
-          g_strdup(udev_device_get_sysattr_value(dev, "idVendor"));
-      info->product_id =
-          g_strdup(udev_device_get_sysattr_value(dev, "idProduct"));
-      g_hash_table_insert(context->devices, info->devpath, info);
-
-      g_print("Keyboard already CONNECTED: %s (Vendor: %s, Product: %s)\n",
-              devpath, info->vendor_id, info->product_id);
-      connected = TRUE;
+  udev_list_entry_foreach(entry, udev_enumerate_get_list_entry(enumerate)) {
+    struct udev_device *dev = udev_device_new_from_syspath(
+        udev_ctx, udev_list_entry_get_name(entry));
+    if (dev && udev_device_get_devnode(dev)) {
+      g_ptr_array_add(devnodes, g_strdup(udev_device_get_devnode(dev)));
+    }
+    if (dev) {
+      udev_device_unref(dev);
     }
-    udev_device_unref(dev);
   }
   udev_enumerate_unref(enumerate);
+}
+
+// Finds keyboards that are already connected, off the main loop. Each rule is
+// its own enumeration matching the id sysattrs, so only the keyboards
+// themselves are opened. libudev contexts are not thread safe, so the thread
+// uses its own.
+static void enumerate_thread(GTask *task, gpointer source, gpointer task_data,
+                             GCancellable *cancellable) {
+  const duet_config_t *config = task_data;
+  struct udev *udev_ctx = udev_new();
+  GPtrArray *found = g_ptr_array_new_with_free_func(found_device_free);
 
+  for (guint i = 0; udev_ctx && i < config->n_keyboard_devices; i++) {
+    const duet_device_rule_t *rule = &config->keyboard_devices[i];
+    struct udev_enumerate *enumerate = udev_enumerate_new(udev_ctx);
+    udev_enumerate_add_match_subsystem(enumerate, "usb");
+    udev_enumerate_add_match_property(enumerate, "DEVTYPE", "usb_device");
+    udev_enumerate_add_match_sysattr(enumerate, "idVendor", rule->vendor_id);
+    udev_enumerate_add_match_sysattr(enumerate, "idProduct",
+                                     rule->product_id);
+    if (config->keyboard_udev_tag) {
+      udev_enumerate_add_match_tag(enumerate, config->keyboard_udev_tag);
+    }
+    udev_enumerate_scan_devices(enumerate);
+
+    struct udev_list_entry *entry;
+    udev_list_entry_foreach(entry, udev_enumerate_get_list_entry(enumerate)) {
+      struct udev_device *dev = udev_device_new_from_syspath(
+          udev_ctx, udev_list_entry_get_name(entry));
+      if (!dev) {
+        continue;
+      }
+
+      found_device_t *device = g_new0(found_device_t, 1);
+      device->info = g_new0(device_info_t, 1);
+      device->info->devpath = g_strdup(udev_device_get_devpath(dev));
+      device->info->vendor_id = g_strdup(rule->vendor_id);
+      device->info->product_id = g_strdup(rule->product_id);
+      device->devnodes = g_ptr_array_new_with_free_func(g_free);
+      if (config->keyboard_watch_input_nodes) {
+        find_input_nodes(udev_ctx, dev, device->devnodes);
+      }
+      g_ptr_array_add(found, device);
+      udev_device_unref(dev);
+    }
+    udev_enumerate_unref(enumerate);
+  }
+
+  if (udev_ctx) {
+    udev_unref(udev_ctx);
+  }
+  g_task_return_pointer(task, found, (GDestroyNotify)g_ptr_array_unref);
+}
+
+static void enumerate_done(GObject *source, GAsyncResult *res, gpointer data) {
+  keyboard_context_t *context = data;
+  GPtrArray *found = g_task_propagate_pointer(G_TASK(res), NULL);
+
+  for (guint i = 0; i < found->len; i++) {
+    found_device_t *device = g_ptr_array_index(found, i);
+    device_info_t *info = device->info;
+    // An add or remove event may have been handled while the thread ran
+    if (g_hash_table_contains(context->devices, info->devpath) ||
+        g_hash_table_contains(context->removed, info->devpath)) {
+      continue;
+    }
+    device->info = NULL;
+    g_hash_table_insert(context->devices, info->devpath, info);
+    g_print("Keyboard already CONNECTED: %s (Vendor: %s, Product: %s)\n",
+            info->devpath, info->vendor_id, info->product_id);
+    for (guint j = 0; j < device->devnodes->len; j++) {
+      watch_input_node(g_ptr_array_index(device->devnodes, j));
+    }
+  }
+  g_ptr_array_unref(found);
+  g_clear_pointer(&context->removed, g_hash_table_destroy);
+
+  gboolean connected = g_hash_table_size(context->devices) > 0;
   context->context->keyboardConnected = connected;
+  rotation_set_needed(!connected);
+  display_startup_done(context->context, STARTUP_KEYBOARD);
 }
 
-void keyboard_watch(duet_context_t *context) {
+void keyboard_watch(duet_context_t *context, const duet_config_t *config) {
   kb_context.context = context;
+  kb_context.config = config;
   kb_context.devices =
       g_hash_table_new_full(g_str_hash, g_str_equal, NULL, free_device_info);
+  kb_context.removed =
+      g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
 
   kb_context.udev_ctx = udev_new();
   kb_context.monitor =
       udev_monitor_new_from_netlink(kb_context.udev_ctx, "udev");
+  // Filters are compiled into a socket filter, so the kernel drops other
+  // devices' events before they wake us
   udev_monitor_filter_add_match_subsystem_devtype(kb_context.monitor, "usb",
                                                   "usb_device");
+  if (config->keyboard_udev_tag) {
+    udev_monitor_filter_add_match_tag(kb_context.monitor,
+                                      config->keyboard_udev_tag);
+  }
   udev_monitor_enable_receiving(kb_context.monitor);
 
   int fd = udev_monitor_get_fd(kb_context.monitor);
@@ -137,11 +371,49 @@ void keyboard_watch(duet_context_t *context) {
   GIOChannel *channel = g_io_channel_unix_new(fd);
   g_io_add_watch(channel, G_IO_IN, udev_event, &kb_context);
 
-  check_initial_devices(&kb_context);
+  // A tag filter applies to every event of a monitor, and the keyboard's
+  // input nodes are usually untagged, so they get a monitor of their own
+  if (config->keyboard_watch_input_nodes) {
+    kb_context.input_monitor =
+        udev_monitor_new_from_netlink(kb_context.udev_ctx, "udev");
+    udev_monitor_filter_add_match_subsystem_devtype(kb_context.input_monitor,
+                                                    "input", NULL);
+    udev_monitor_enable_receiving(kb_context.input_monitor);
+    int input_fd = udev_monitor_get_fd(kb_context.input_monitor);
+    fcntl(input_fd, F_SETFL, O_NONBLOCK);
+    kb_context.input_channel = g_io_channel_unix_new(input_fd);
+    kb_context.input_watch_id = g_io_add_watch(
+        kb_context.input_channel, G_IO_IN, input_event, &kb_context);
+  }
+
+  GTask *task = g_task_new(NULL, NULL, enumerate_done, &kb_context);
+  g_task_set_task_data(task, (gpointer)config, NULL);
+  g_task_run_in_thread(task, enumerate_thread);
+  g_object_unref(task);
+
+  if (config->keyboard_switch_device) {
+    evdev_watch_switch(config->keyboard_switch_device, switch_changed,
+                       &kb_context);
+  }
 }
 
 void keyboard_cleanup() {
+  cancel_confirm(&kb_context);
+  evdev_cleanup();
+  if (kb_context.input_watch_id) {
+    g_source_remove(kb_context.input_watch_id);
+    kb_context.input_watch_id = 0;
+  }
+  if (kb_context.input_channel) {
+    g_io_channel_unref(kb_context.input_channel);
+    kb_context.input_channel = NULL;
+  }
+  if (kb_context.input_monitor) {
+    udev_monitor_unref(kb_context.input_monitor);
+    kb_context.input_monitor = NULL;
+  }
   udev_monitor_unref(kb_context.monitor);
   udev_unref(kb_context.udev_ctx);
   g_hash_table_destroy(kb_context.devices);
+  g_clear_pointer(&kb_context.removed, g_hash_table_destroy);
 }
@@ -0,0 +1,299 @@
+#include "niri.h"
+
+#include <gio/gio.h>
+#include <json-glib/json-glib.h>
+#include <string.h>
+
+#include "ipc.h"
+
+static guint event_watch = 0;
+static void (*events_changed)(gboolean closed) = NULL;
+
+static const char *transform_name(int transform) {
+  switch (transform) {
+  case 90:
+    return "90";
+  case 180:
+    return "180";
+  case 270:
+    return "270";
+  default:
+    return "Normal";
+  }
+}
+
+// Parses niri's transform names, ignoring flips.
+static int parse_transform(const gchar *name) {
+  if (g_str_has_prefix(name, "Flipped")) {
+    name += strlen("Flipped");
+  }
+  return g_str_equal(name, "90")    ? 90
+         : g_str_equal(name, "180") ? 180
+         : g_str_equal(name, "270") ? 270
+                                    : 0;
+}
+
+static gboolean niri_query(display_state_t *state, GCancellable *cancellable,
+                           GError **error);
+
+static gboolean niri_available(void) {
+  const gchar *path = g_getenv("NIRI_SOCKET");
+  return path && g_file_test(path, G_FILE_TEST_EXISTS);
+}
+
+// Builds an output action request, e.g. for "On" or
+// {"Transform":{"transform":"90"}}.
+static gchar *output_action(const gchar *output, const gchar *action) {
+  return g_strdup_printf("{\"Output\":{\"output\":\"%s\",\"action\":%s}}\n",
+                         output, action);
+}
+
+// The logical size the output has once its transform is applied. An output
+// that is off has no logical size yet; both panels are the same, so the
+// other one's is used instead.
+static void target_size(const display_output_t *target,
+                        const display_output_state_t *current,
+                        const display_output_state_t *other, int *width,
+                        int *height) {
+  const display_output_state_t *known = current->enabled ? current : other;
+  *width = known->width;
+  *height = known->height;
+  // A quarter turn swaps the logical width and height
+  if ((target->transform - known->transform) % 180 != 0) {
+    *width = known->height;
+    *height = known->width;
+  }
+}
+
+// Builds the Position action for the secondary output's placement, e.g.
+// {"Position":{"position":{"Specific":{"x":0,"y":1200}}}}. niri only places
+// outputs automatically or at explicit coordinates.
+static gchar *position_action(const display_layout_t *layout,
+                              const display_state_t *state) {
+  const display_output_t *output = &layout->secondary;
+  if (output->placement == PLACEMENT_AUTO) {
+    return g_strdup("{\"Position\":{\"position\":\"Automatic\"}}");
+  }
+
+  int primary_width, primary_height, width, height;
+  target_size(&layout->primary, &state->primary, &state->secondary,
+              &primary_width, &primary_height);
+  target_size(output, &state->secondary, &state->primary, &width, &height);
+  int x = state->primary.enabled ? state->primary.x : 0;
+  int y = state->primary.enabled ? state->primary.y : 0;
+  switch (output->placement) {
+  case PLACEMENT_BELOW:
+    y += primary_height;
+    break;
+  case PLACEMENT_LEFT:
+    x -= width;
+    break;
+  case PLACEMENT_RIGHT:
+    x += primary_width;
+    break;
+  }
+  return g_strdup_printf(
+      "{\"Position\":{\"position\":{\"Specific\":{\"x\":%d,\"y\":%d}}}}", x,
+      y);
+}
+
+static void add_output_actions(GPtrArray *requests,
+                               const display_layout_t *layout,
+                               const display_output_t *output,
+                               const display_state_t *state) {
+  if (!output->enabled) {
+    if (output->changes & DIFF_ENABLED) {
+      g_ptr_array_add(requests, output_action(output->name, "\"Off\""));
+    }
+    return;
+  }
+
+  // niri has no mirroring; a mirrored output is enabled unrotated at an
+  // automatic position instead.
+  if (output->changes & DIFF_ENABLED) {
+    g_ptr_array_add(requests, output_action(output->name, "\"On\""));
+  }
+  if (output->changes & DIFF_TRANSFORM) {
+    gchar *transform =
+        g_strdup_printf("{\"Transform\":{\"transform\":\"%s\"}}",
+                        transform_name(output->transform));
+    g_ptr_array_add(requests, output_action(output->name, transform));
+    g_free(transform);
+  }
+  // Placement is relative to the primary output, which stays where it is. An
+  // output turning into a mirror also drops its explicit position.
+  gboolean reposition =
+      (output->changes & DIFF_PLACEMENT) ||
+      (output->mirror && (output->changes & DIFF_TRANSFORM));
+  if (reposition && output == &layout->secondary) {
+    gchar *position = position_action(layout, state);
+    g_ptr_array_add(requests, output_action(output->name, position));
+    g_free(position);
+  }
+}
+
+static gboolean niri_apply(const display_layout_t *layout,
+                           GCancellable *cancellable, GError **error) {
+  if (!niri_available()) {
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                "niri socket not found");
+    return FALSE;
+  }
+
+  // Explicit positions need the outputs' current geometry
+  display_state_t state = {.primary = {.name = layout->primary.name},
+                           .secondary = {.name = layout->secondary.name}};
+  if ((layout->secondary.changes & DIFF_PLACEMENT) &&
+      layout->secondary.placement != PLACEMENT_AUTO &&
+      !niri_query(&state, cancellable, error)) {
+    return FALSE;
+  }
+
+  // niri takes one request per connection and has no batch request, so all
+  // actions are written up front and niri applies them in one pass of its
+  // event loop instead of one round trip each.
+  GPtrArray *requests = g_ptr_array_new_with_free_func(g_free);
+  add_output_actions(requests, layout, &layout->primary, &state);
+  add_output_actions(requests, layout, &layout->secondary, &state);
+  if (requests->len == 0) {
+    g_ptr_array_unref(requests);
+    return TRUE;
+  }
+  g_ptr_array_add(requests, NULL);
+
+  gchar **replies =
+      ipc_request_all(g_getenv("NIRI_SOCKET"),
+                      (const gchar *const *)requests->pdata, TRUE, cancellable,
+                      error);
+  gboolean ok = replies != NULL;
+  for (guint i = 0; ok && replies[i]; i++) {
+    if (!g_str_has_prefix(replies[i], "{\"Ok\"")) {
+      g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "niri rejected %s: %s",
+                  g_strstrip((gchar *)requests->pdata[i]),
+                  g_strstrip(replies[i]));
+      ok = FALSE;
+    }
+  }
+
+  g_strfreev(replies);
+  g_ptr_array_unref(requests);
+  return ok;
+}
+
+// Returns the member called name if it is an object, otherwise NULL.
+static JsonObject *object_member(JsonObject *object, const gchar *name) {
+  JsonNode *node = object ? json_object_get_member(object, name) : NULL;
+  return node && JSON_NODE_HOLDS_OBJECT(node) ? json_node_get_object(node)
+                                              : NULL;
+}
+
+// Fills in state from the reply to an Outputs request.
+static gboolean parse_outputs(const gchar *reply, display_state_t *state,
+                              GError **error) {
+  JsonParser *parser = json_parser_new();
+  if (!json_parser_load_from_data(parser, reply, -1, error)) {
+    g_object_unref(parser);
+    return FALSE;
+  }
+
+  // {"Ok":{"Outputs":{"eDP-1":{..., "logical":{...}|null}}}}
+  JsonNode *root = json_parser_get_root(parser);
+  JsonObject *outputs = NULL;
+  if (root && JSON_NODE_HOLDS_OBJECT(root)) {
+    outputs = object_member(object_member(json_node_get_object(root), "Ok"),
+                            "Outputs");
+  }
+  if (!outputs) {
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                "Unexpected niri outputs reply: %s", reply);
+    g_object_unref(parser);
+    return FALSE;
+  }
+
+  display_output_state_t *targets[] = {&state->primary, &state->secondary};
+  for (gsize i = 0; i < G_N_ELEMENTS(targets); i++) {
+    display_output_state_t *output = targets[i];
+    JsonObject *info = object_member(outputs, output->name);
+    if (!info) {
+      continue;
+    }
+
+    output->present = TRUE;
+    JsonObject *logical = object_member(info, "logical");
+    output->enabled = logical != NULL;
+    if (logical) {
+      output->x = json_object_get_int_member_with_default(logical, "x", 0);
+      output->y = json_object_get_int_member_with_default(logical, "y", 0);
+      output->width =
+          json_object_get_int_member_with_default(logical, "width", 0);
+      output->height =
+          json_object_get_int_member_with_default(logical, "height", 0);
+      output->transform = parse_transform(
+          json_object_get_string_member_with_default(logical, "transform",
+                                                     "Normal"));
+    }
+  }
+
+  g_object_unref(parser);
+  return TRUE;
+}
+
+static gboolean niri_query(display_state_t *state, GCancellable *cancellable,
+                           GError **error) {
+  if (!niri_available()) {
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                "niri socket not found");
+    return FALSE;
+  }
+
+  gchar *reply = ipc_request(g_getenv("NIRI_SOCKET"), "\"Outputs\"\n", TRUE,
+                             cancellable, error);
+  if (!reply) {
+    return FALSE;
+  }
+  gboolean ok = parse_outputs(reply, state, error);
+  g_free(reply);
+  return ok;
+}
+
+static void event_line(const gchar *line, gpointer data) {
+  // niri has no output event; workspaces move when outputs come and go, and
+  // output settings change with the config.
+  if (g_str_has_prefix(line, "{\"WorkspacesChanged\"") ||
+      g_str_has_prefix(line, "{\"ConfigLoaded\"")) {
+    events_changed(FALSE);
+  }
+}
+
+static void event_closed(gpointer data) {
+  event_watch = 0;
+  events_changed(TRUE);
+}
+
+static gboolean niri_subscribe(void (*changed)(gboolean closed),
+                               GError **error) {
+  if (!niri_available()) {
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                "niri socket not found");
+    return FALSE;
+  }
+
+  events_changed = changed;
+  event_watch = ipc_subscribe(g_getenv("NIRI_SOCKET"), "\"EventStream\"\n",
+                              event_line, event_closed, NULL, error);
+  return event_watch != 0;
+}
+
+static void niri_unsubscribe(void) {
+  ipc_unsubscribe(event_watch);
+  event_watch = 0;
+}
+
+const display_backend_t niri_backend = {
+    .name = "niri",
+    .available = niri_available,
+    .apply = niri_apply,
+    .query = niri_query,
+    .subscribe = niri_subscribe,
+    .unsubscribe = niri_unsubscribe,
+};
@@ -0,0 +1,6 @@
+#pragma once
+
+#include "display.h"
+
+/** Display backend talking to niri over $NIRI_SOCKET */
+extern const display_backend_t niri_backend;
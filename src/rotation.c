@@ -3,14 +3,76 @@
 #include <gio/gio.h>
 
 #include "display.h"
+#include "iio.h"
+#include "trace.h"
 
-static GMainLoop *loop;
 static guint watch_id;
 static GDBusProxy *iio_proxy;
+static gboolean iio_active;
+static duet_context_t *rotation_context;
+
+// Whether orientation is needed, i.e. the keyboard is detached
+static gboolean needed;
+// Whether the accelerometer is claimed from iio-sensor-proxy
+static gboolean claimed;
+// Time spent claimed, to show what releasing it saves
+static gint64 watch_start;
+static gint64 claimed_since;
+static gint64 claimed_total;
+// Orientation signals received from iio-sensor-proxy
+static guint64 proxy_wakeups;
+
+// The last orientation reported by each source, to compare their latency
+// when COMPARE_PROXY is set
+typedef struct {
+  gchar *orientation;
+  gint64 time;
+} report_t;
+static report_t iio_report, proxy_report;
+
+// Records an orientation report and, if the other source already reported
+// the same orientation, logs how far apart the two were
+static void compare_report(report_t *report, const report_t *other,
+                           const gchar *orientation) {
+  g_free(report->orientation);
+  report->orientation = g_strdup(orientation);
+  report->time = g_get_monotonic_time();
+  if (g_strcmp0(other->orientation, orientation) != 0) {
+    return;
+  }
+
+  gint64 lead = proxy_report.time - iio_report.time;
+  g_print("Orientation %s: iio backend %.1f ms %s iio-sensor-proxy\n",
+          orientation, ABS(lead) / 1000.0, lead >= 0 ? "ahead of" : "behind");
+}
+
+static void update_rotation(duet_context_t *context, const gchar *orientation,
+                            guint trace_id) {
+  int rotation = parse_orientation(orientation);
+  if (rotation != -1) {
+    context->rotation = rotation;
+  }
+  display_schedule_layout(context, FALSE, trace_id);
+}
+
+// Lets the first layout go ahead, either with a live reading or because no
+// sensor is available
+static void orientation_known(void) {
+  display_startup_done(rotation_context, STARTUP_ROTATION);
+}
+
+static void iio_changed(const gchar *orientation, gpointer data) {
+  guint trace_id = trace_event("rotation iio");
+  g_print("Orientation changed: %s\n", orientation);
+  compare_report(&iio_report, &proxy_report, orientation);
+  update_rotation(data, orientation, trace_id);
+  orientation_known();
+}
 
 static void properties_changed(GDBusProxy *proxy, GVariant *changed_properties,
                                GStrv invalidated_properties, gpointer data) {
   duet_context_t *context = (duet_context_t *)data;
+  proxy_wakeups++;
 
   GVariantDict dict;
   g_variant_dict_init(&dict, changed_properties);
@@ -19,13 +81,17 @@ static void properties_changed(GDBusProxy *proxy, GVariant *changed_properties,
     GVariant *val = g_variant_dict_lookup_value(
         &dict, "AccelerometerOrientation", G_VARIANT_TYPE_STRING);
     if (val) {
-      g_print("Orientation changed: %s\n", g_variant_get_string(val, NULL));
-      int rotation = parse_orientation(g_variant_get_string(val, NULL));
-      if (rotation != -1) {
-        context->rotation = rotation;
+      const gchar *orientation = g_variant_get_string(val, NULL);
+      if (iio_active) {
+        // Only followed for comparison, the iio backend drives the layout
+        compare_report(&proxy_report, &iio_report, orientation);
+      } else {
+        guint trace_id = trace_event("rotation proxy");
+        g_print("Orientation changed: %s\n", orientation);
+        update_rotation(context, orientation, trace_id);
+        orientation_known();
       }
       g_variant_unref(val);
-      setLayout(context);
     }
   }
 
@@ -33,69 +99,179 @@ static void properties_changed(GDBusProxy *proxy, GVariant *changed_properties,
 }
 
 static void check_initial_value(duet_context_t *context) {
+  if (iio_active) {
+    return;
+  }
+
   GVariant *val =
       g_dbus_proxy_get_cached_property(iio_proxy, "AccelerometerOrientation");
   if (val) {
     g_print("Initial orientation: %s\n", g_variant_get_string(val, NULL));
-    int rotation = parse_orientation(g_variant_get_string(val, NULL));
-    if (rotation != -1) {
-      context->rotation = rotation;
-    }
+    update_rotation(context, g_variant_get_string(val, NULL), 0);
     g_variant_unref(val);
-    setLayout(context);
   } else {
     g_print("No accelerometer available\n");
   }
 }
 
-static void proxy_connected(GDBusConnection *connection, const gchar *name,
-                            const gchar *name_owner, gpointer data) {
-  duet_context_t *context = (duet_context_t *)data;
-
+static void orientation_refreshed(GObject *source, GAsyncResult *res,
+                                  gpointer data) {
   GError *error = NULL;
-  GVariant *ret = NULL;
-
-  g_print("Sensor proxy connected\n");
+  GVariant *ret = g_dbus_proxy_call_finish(G_DBUS_PROXY(source), res, &error);
+  if (!ret) {
+    g_warning("Failed to read orientation: %s", error->message);
+    g_error_free(error);
+    orientation_known();
+    return;
+  }
 
-  iio_proxy = g_dbus_proxy_new_for_bus_sync(
-      G_BUS_TYPE_SYSTEM, G_DBUS_PROXY_FLAGS_NONE, NULL,
-      "net.hadess.SensorProxy", "/net/hadess/SensorProxy",
-      "net.hadess.SensorProxy", NULL, &error);
+  GVariant *val;
+  g_variant_get(ret, "(v)", &val);
+  if (g_variant_is_of_type(val, G_VARIANT_TYPE_STRING)) {
+    g_print("Refreshed orientation: %s\n", g_variant_get_string(val, NULL));
+    update_rotation(rotation_context, g_variant_get_string(val, NULL), 0);
+  }
+  g_variant_unref(val);
+  g_variant_unref(ret);
+  orientation_known();
+}
 
-  if (!iio_proxy) {
-    g_warning("Failed to create proxy: %s", error->message);
+static void claim_done(GObject *source, GAsyncResult *res, gpointer data) {
+  GError *error = NULL;
+  GVariant *ret = g_dbus_proxy_call_finish(G_DBUS_PROXY(source), res, &error);
+  if (!ret) {
+    g_warning("Failed to claim accelerometer: %s", error->message);
     g_error_free(error);
-    g_main_loop_quit(loop);
+    claimed = FALSE;
+    orientation_known();
     return;
   }
+  g_variant_unref(ret);
 
-  g_signal_connect(iio_proxy, "g-properties-changed",
-                   G_CALLBACK(properties_changed), context);
+  // The cached property went stale while released, so ask for the current
+  // orientation rather than waiting for the next change
+  if (!iio_active && claimed) {
+    g_dbus_proxy_call(G_DBUS_PROXY(source),
+                      "org.freedesktop.DBus.Properties.Get",
+                      g_variant_new("(ss)", "net.hadess.SensorProxy",
+                                    "AccelerometerOrientation"),
+                      G_DBUS_CALL_FLAGS_NONE, -1, NULL, orientation_refreshed,
+                      NULL);
+  }
+}
 
-  ret = g_dbus_proxy_call_sync(iio_proxy, "ClaimAccelerometer", NULL,
-                               G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+static void release_done(GObject *source, GAsyncResult *res, gpointer data) {
+  GError *error = NULL;
+  GVariant *ret = g_dbus_proxy_call_finish(G_DBUS_PROXY(source), res, &error);
   if (!ret) {
-    g_warning("Failed to claim accelerometer: %s", error->message);
+    g_warning("Failed to release accelerometer: %s", error->message);
     g_error_free(error);
-    g_clear_object(&iio_proxy);
-    g_main_loop_quit(loop);
     return;
   }
   g_variant_unref(ret);
+}
+
+// Claims or releases the accelerometer to match whether orientation is
+// needed. Calls on one connection are ordered, so a release queued behind a
+// claim still wins.
+static void update_claim(void) {
+  if (!iio_proxy || claimed == needed) {
+    return;
+  }
+
+  claimed = needed;
+  gint64 now = g_get_monotonic_time();
+  if (claimed) {
+    claimed_since = now;
+    g_print("Claiming accelerometer\n");
+    g_dbus_proxy_call(iio_proxy, "ClaimAccelerometer", NULL,
+                      G_DBUS_CALL_FLAGS_NONE, -1, NULL, claim_done, NULL);
+  } else {
+    claimed_total += now - claimed_since;
+    g_print("Releasing accelerometer while the keyboard is attached "
+            "(%" G_GUINT64_FORMAT " orientation signals so far)\n",
+            proxy_wakeups);
+    g_dbus_proxy_call(iio_proxy, "ReleaseAccelerometer", NULL,
+                      G_DBUS_CALL_FLAGS_NONE, -1, NULL, release_done, NULL);
+  }
+}
+
+void rotation_set_needed(gboolean is_needed) {
+  needed = is_needed;
+  if (iio_active) {
+    iio_set_active(needed);
+  }
+  update_claim();
+}
+
+static void proxy_ready(GObject *source, GAsyncResult *res, gpointer data) {
+  duet_context_t *context = (duet_context_t *)data;
+  GError *error = NULL;
+
+  GDBusProxy *proxy = g_dbus_proxy_new_for_bus_finish(res, &error);
+  if (!proxy) {
+    g_warning("Failed to create proxy: %s", error->message);
+    g_error_free(error);
+    orientation_known();
+    return;
+  }
 
+  iio_proxy = proxy;
+  g_print("Startup: sensor proxy ready after %.1f ms\n",
+          (g_get_monotonic_time() - watch_start) / 1000.0);
+  g_signal_connect(iio_proxy, "g-properties-changed",
+                   G_CALLBACK(properties_changed), context);
+
+  // The cached value is only used while the keyboard is attached. Otherwise
+  // the accelerometer is claimed and read once the claim completes.
   check_initial_value(context);
+  if (!needed) {
+    g_print("Keyboard attached, not claiming accelerometer\n");
+  }
+  update_claim();
+}
+
+static void proxy_connected(GDBusConnection *connection, const gchar *name,
+                            const gchar *name_owner, gpointer data) {
+  g_print("Sensor proxy connected\n");
+
+  g_dbus_proxy_new_for_bus(G_BUS_TYPE_SYSTEM, G_DBUS_PROXY_FLAGS_NONE, NULL,
+                           "net.hadess.SensorProxy", "/net/hadess/SensorProxy",
+                           "net.hadess.SensorProxy", NULL, proxy_ready, data);
 }
 
 static void proxy_disconnected(GDBusConnection *connection, const gchar *name,
                                gpointer data) {
+  if (claimed) {
+    claimed_total += g_get_monotonic_time() - claimed_since;
+    claimed = FALSE;
+  }
   if (iio_proxy) {
     g_signal_handlers_disconnect_by_data(iio_proxy, NULL);
     g_clear_object(&iio_proxy);
     g_print("Sensor proxy disconnected\n");
   }
+  // Don't hold up startup when there is no sensor proxy
+  orientation_known();
 }
 
-void rotation_watch(duet_context_t *context) {
+void rotation_watch(duet_context_t *context, const duet_config_t *config) {
+  rotation_context = context;
+  needed = !context->keyboardConnected;
+  watch_start = g_get_monotonic_time();
+
+  if (g_strcmp0(config->rotation_backend, "iio") == 0) {
+    iio_active = iio_watch(config, iio_changed, context);
+    if (iio_active) {
+      iio_set_active(needed);
+    }
+    if (!iio_active) {
+      g_printerr("Falling back to iio-sensor-proxy for orientation\n");
+    } else if (!config->rotation_compare_proxy) {
+      return;
+    }
+  }
+
   watch_id = g_bus_watch_name(G_BUS_TYPE_SYSTEM, "net.hadess.SensorProxy",
                               G_BUS_NAME_WATCHER_FLAGS_NONE, proxy_connected,
                               proxy_disconnected, context, NULL);
@@ -103,4 +279,23 @@ void rotation_watch(duet_context_t *context) {
   g_print("Waiting for sensor proxy...\n");
 }
 
-void rotation_cleanup() { g_bus_unwatch_name(watch_id); }
+void rotation_cleanup() {
+  gint64 now = g_get_monotonic_time();
+  gint64 total = claimed ? claimed_total + now - claimed_since : claimed_total;
+  g_print("Orientation sensor was in use for %.1f of %.1f s (%" G_GUINT64_FORMAT
+          " proxy signals, %" G_GUINT64_FORMAT " accelerometer reads)\n",
+          (iio_active ? iio_get_active_time() : total) / (double)G_USEC_PER_SEC,
+          (now - watch_start) / (double)G_USEC_PER_SEC, proxy_wakeups,
+          iio_active ? iio_get_reads() : 0);
+
+  if (watch_id) {
+    g_bus_unwatch_name(watch_id);
+    watch_id = 0;
+  }
+  if (iio_active) {
+    iio_cleanup();
+    iio_active = FALSE;
+  }
+  g_clear_pointer(&iio_report.orientation, g_free);
+  g_clear_pointer(&proxy_report.orientation, g_free);
+}
@@ -1,6 +1,14 @@
 #pragma once
 
+#include "config.h"
 #include "context.h"
 
-void rotation_watch(duet_context_t *context);
+void rotation_watch(duet_context_t *context, const duet_config_t *config);
 void rotation_cleanup();
+
+/**
+ * Sets whether orientation is currently needed. While it is not, the
+ * accelerometer is released so the sensor can stop polling; once it is
+ * needed again it is claimed and the orientation is refreshed.
+ */
+void rotation_set_needed(gboolean needed);
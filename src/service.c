@@ -0,0 +1,214 @@
+#include "service.h"
+
+#include <gio/gio.h>
+#include <stdio.h>
+
+#include "display.h"
+#include "trace.h"
+
+#define SERVICE_NAME "org.duet.Daemon"
+#define SERVICE_PATH "/org/duet/Daemon"
+#define SERVICE_INTERFACE "org.duet.Daemon"
+
+static const gchar introspection_xml[] =
+    "<node>"
+    "  <interface name='" SERVICE_INTERFACE "'>"
+    "    <method name='SetMode'>"
+    "      <arg type='s' name='mode' direction='in'/>"
+    "      <arg type='s' name='layout' direction='out'/>"
+    "    </method>"
+    "    <property name='Mode' type='s' access='read'/>"
+    "    <property name='Rotation' type='s' access='read'/>"
+    "    <property name='KeyboardConnected' type='b' access='read'/>"
+    "    <property name='Layout' type='s' access='read'/>"
+    "  </interface>"
+    "</node>";
+
+static duet_context_t *service_context = NULL;
+static GDBusNodeInfo *node_info = NULL;
+static GDBusConnection *connection = NULL;
+static guint owner_id = 0;
+static guint registration_id = 0;
+
+// The property values last announced, -2 before the first announcement
+static int published_mode = -2;
+static int published_rotation = -2;
+static int published_keyboard = -2;
+static int published_layout = -2;
+
+static GVariant *get_property(GDBusConnection *bus, const gchar *sender,
+                              const gchar *path, const gchar *interface,
+                              const gchar *property, GError **error,
+                              gpointer data) {
+  if (g_str_equal(property, "Mode")) {
+    return g_variant_new_string(mode_name(service_context->mode));
+  } else if (g_str_equal(property, "Rotation")) {
+    return g_variant_new_string(rotation_name(service_context->rotation));
+  } else if (g_str_equal(property, "KeyboardConnected")) {
+    return g_variant_new_boolean(service_context->keyboardConnected);
+  } else if (g_str_equal(property, "Layout")) {
+    return g_variant_new_string(
+        display_layout_name(display_get_applied_layout()));
+  }
+  g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_PROPERTY,
+              "Unknown property %s", property);
+  return NULL;
+}
+
+// Answers SetMode once the layout it leads to is applied
+static void set_mode_done(int layout, gpointer data) {
+  GDBusMethodInvocation *invocation = data;
+  if (layout == -1) {
+    g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR,
+                                          G_DBUS_ERROR_FAILED,
+                                          "Layout not applied");
+  } else {
+    g_dbus_method_invocation_return_value(
+        invocation, g_variant_new("(s)", display_layout_name(layout)));
+  }
+}
+
+static void method_call(GDBusConnection *bus, const gchar *sender,
+                        const gchar *path, const gchar *interface,
+                        const gchar *method, GVariant *parameters,
+                        GDBusMethodInvocation *invocation, gpointer data) {
+  if (!g_str_equal(method, "SetMode")) {
+    g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR,
+                                          G_DBUS_ERROR_UNKNOWN_METHOD,
+                                          "Unknown method %s", method);
+    return;
+  }
+
+  const gchar *name;
+  g_variant_get(parameters, "(&s)", &name);
+  int mode = parse_mode(name);
+  if (mode == -1) {
+    g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR,
+                                          G_DBUS_ERROR_INVALID_ARGS,
+                                          "Unknown mode %s", name);
+    return;
+  }
+
+  guint trace_id = trace_event("dbus SetMode");
+  printf("Received mode switch over D-Bus: %d, old mode: %d\n", mode,
+         service_context->mode);
+  service_context->mode = mode;
+  display_schedule_layout(service_context, TRUE, trace_id);
+  display_when_idle(set_mode_done, invocation);
+}
+
+static const GDBusInterfaceVTable interface_vtable = {
+    .method_call = method_call,
+    .get_property = get_property,
+};
+
+static void bus_acquired(GDBusConnection *bus, const gchar *name,
+                         gpointer data) {
+  GError *error = NULL;
+  registration_id = g_dbus_connection_register_object(
+      bus, SERVICE_PATH, node_info->interfaces[0], &interface_vtable, NULL,
+      NULL, &error);
+  if (!registration_id) {
+    g_printerr("Failed to export %s: %s\n", SERVICE_PATH, error->message);
+    g_error_free(error);
+    return;
+  }
+  connection = g_object_ref(bus);
+}
+
+static void name_acquired(GDBusConnection *bus, const gchar *name,
+                          gpointer data) {
+  g_print("Serving %s on the session bus\n", name);
+}
+
+static void name_lost(GDBusConnection *bus, const gchar *name,
+                      gpointer data) {
+  g_printerr("Not serving %s on the session bus\n", name);
+}
+
+void service_watch(duet_context_t *context) {
+  service_context = context;
+
+  GError *error = NULL;
+  node_info = g_dbus_node_info_new_for_xml(introspection_xml, &error);
+  if (!node_info) {
+    g_printerr("Failed to parse D-Bus interface: %s\n", error->message);
+    g_error_free(error);
+    return;
+  }
+
+  // Replacing lets a newly started duetd take over from this one
+  owner_id = g_bus_own_name(G_BUS_TYPE_SESSION, SERVICE_NAME,
+                            G_BUS_NAME_OWNER_FLAGS_ALLOW_REPLACEMENT |
+                                G_BUS_NAME_OWNER_FLAGS_REPLACE,
+                            bus_acquired, name_acquired, name_lost, NULL,
+                            NULL);
+}
+
+void service_publish_state(void) {
+  if (!connection) {
+    return;
+  }
+
+  GVariantBuilder changed;
+  g_variant_builder_init(&changed, G_VARIANT_TYPE_VARDICT);
+  gboolean any = FALSE;
+
+  if (service_context->mode != published_mode) {
+    published_mode = service_context->mode;
+    g_variant_builder_add(&changed, "{sv}", "Mode",
+                          g_variant_new_string(mode_name(published_mode)));
+    any = TRUE;
+  }
+  if (service_context->rotation != published_rotation) {
+    published_rotation = service_context->rotation;
+    g_variant_builder_add(
+        &changed, "{sv}", "Rotation",
+        g_variant_new_string(rotation_name(published_rotation)));
+    any = TRUE;
+  }
+  if (service_context->keyboardConnected != published_keyboard) {
+    published_keyboard = service_context->keyboardConnected;
+    g_variant_builder_add(&changed, "{sv}", "KeyboardConnected",
+                          g_variant_new_boolean(published_keyboard));
+    any = TRUE;
+  }
+  if (display_get_applied_layout() != published_layout) {
+    published_layout = display_get_applied_layout();
+    g_variant_builder_add(
+        &changed, "{sv}", "Layout",
+        g_variant_new_string(display_layout_name(published_layout)));
+    any = TRUE;
+  }
+
+  if (!any) {
+    g_variant_builder_clear(&changed);
+    return;
+  }
+
+  GError *error = NULL;
+  if (!g_dbus_connection_emit_signal(
+          connection, NULL, SERVICE_PATH, "org.freedesktop.DBus.Properties",
+          "PropertiesChanged",
+          g_variant_new("(sa{sv}as)", SERVICE_INTERFACE, &changed, NULL),
+          &error)) {
+    g_printerr("Failed to emit PropertiesChanged: %s\n", error->message);
+    g_error_free(error);
+  }
+}
+
+void service_cleanup(void) {
+  if (registration_id) {
+    g_dbus_connection_unregister_object(connection, registration_id);
+    registration_id = 0;
+  }
+  if (owner_id) {
+    g_bus_unown_name(owner_id);
+    owner_id = 0;
+  }
+  g_clear_object(&connection);
+  if (node_info) {
+    g_dbus_node_info_unref(node_info);
+    node_info = NULL;
+  }
+}
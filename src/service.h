@@ -0,0 +1,15 @@
+#pragma once
+
+#include "context.h"
+
+/**
+ * Owns org.duet.Daemon on the session bus and exports the daemon's state at
+ * /org/duet/Daemon: the Mode, Rotation, KeyboardConnected and Layout
+ * properties, and a SetMode method. A newer duetd takes the name over.
+ */
+void service_watch(duet_context_t *context);
+
+/** Emits PropertiesChanged for the properties that changed since last time */
+void service_publish_state(void);
+
+void service_cleanup(void);
@@ -0,0 +1,169 @@
+#include "spawn.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+// A run of steps joined with &&
+typedef struct {
+  /** Index of the next step to start */
+  guint next;
+  /** Index one past the last step */
+  guint end;
+  /** The running step, or 0 */
+  pid_t pid;
+  /** pidfd of the running step, or -1 if the kernel has no pidfd_open */
+  int pidfd;
+} chain_t;
+
+static int open_pidfd(pid_t pid) { return syscall(SYS_pidfd_open, pid, 0); }
+
+static void record_failure(GError **error, const gchar *format,
+                           const gchar *command, int code) {
+  gchar *message = g_strdup_printf(format, command, code);
+  g_printerr("Layout command step failed: %s\n", message);
+  if (!*error) {
+    g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_FAILED, message);
+  }
+  g_free(message);
+}
+
+// Starts the next step of a chain. Returns FALSE if it could not be spawned.
+static gboolean start_step(const duet_command_plan_t *plan, chain_t *chain,
+                           GError **error) {
+  gchar **argv = plan->steps[chain->next++].argv;
+  int ret = posix_spawnp(&chain->pid, argv[0], NULL, NULL, argv, environ);
+  if (ret != 0) {
+    chain->pid = 0;
+    record_failure(error, "%s could not be started (errno %d)", argv[0], ret);
+    return FALSE;
+  }
+  chain->pidfd = open_pidfd(chain->pid);
+  return TRUE;
+}
+
+static void finish_step(chain_t *chain) {
+  if (chain->pidfd != -1) {
+    close(chain->pidfd);
+    chain->pidfd = -1;
+  }
+  chain->pid = 0;
+}
+
+gboolean spawn_plan(const duet_command_plan_t *plan, gboolean parallel,
+                    GCancellable *cancellable, GError **error) {
+  chain_t *chains = g_new0(chain_t, plan->n_steps);
+  guint n_chains = 0;
+  for (guint i = 0; i < plan->n_steps; i++) {
+    if (i == 0 || !plan->steps[i].and_then) {
+      chains[n_chains++] = (chain_t){.next = i, .pidfd = -1};
+    }
+    chains[n_chains - 1].end = i + 1;
+  }
+
+  GError *first_error = NULL;
+  guint started = 0;
+  guint running = 0;
+
+  // Start every chain at once, or just the first one
+  while (started < n_chains && (parallel || running == 0)) {
+    running += start_step(plan, &chains[started++], &first_error);
+  }
+
+  struct pollfd *fds = g_new(struct pollfd, n_chains + 1);
+  int cancel_fd = g_cancellable_get_fd(cancellable);
+
+  while (running > 0) {
+    nfds_t nfds = 0;
+    gboolean need_tick = FALSE;
+    for (guint i = 0; i < n_chains; i++) {
+      if (chains[i].pidfd != -1) {
+        fds[nfds++] = (struct pollfd){.fd = chains[i].pidfd, .events = POLLIN};
+      } else if (chains[i].pid) {
+        need_tick = TRUE;
+      }
+    }
+    if (cancel_fd != -1) {
+      fds[nfds++] = (struct pollfd){.fd = cancel_fd, .events = POLLIN};
+    }
+
+    // Without pidfds, fall back to checking the children every 10 ms
+    if (poll(fds, nfds, need_tick ? 10 : -1) == -1 && errno != EINTR) {
+      g_clear_error(&first_error);
+      g_set_error(&first_error, G_IO_ERROR, g_io_error_from_errno(errno),
+                  "poll: %s", g_strerror(errno));
+      break;
+    }
+
+    if (g_cancellable_is_cancelled(cancellable)) {
+      g_clear_error(&first_error);
+      g_cancellable_set_error_if_cancelled(cancellable, &first_error);
+      break;
+    }
+
+    for (guint i = 0; i < n_chains; i++) {
+      chain_t *chain = &chains[i];
+      if (!chain->pid) {
+        continue;
+      }
+
+      int status;
+      pid_t ret = waitpid(chain->pid, &status, WNOHANG);
+      if (ret == 0) {
+        continue;
+      }
+      finish_step(chain);
+
+      const gchar *command = plan->steps[chain->next - 1].argv[0];
+      gboolean ok = ret > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+      if (ret == -1) {
+        record_failure(&first_error, "%s could not be waited for (errno %d)",
+                       command, errno);
+      } else if (WIFSIGNALED(status)) {
+        record_failure(&first_error, "%s was killed by signal %d", command,
+                       WTERMSIG(status));
+      } else if (!ok) {
+        record_failure(&first_error, "%s exited with status %d", command,
+                       WEXITSTATUS(status));
+      }
+
+      // Continue the && chain, otherwise it is done
+      if (ok && chain->next < chain->end &&
+          start_step(plan, chain, &first_error)) {
+        continue;
+      }
+      running--;
+
+      while (!parallel && running == 0 && started < n_chains) {
+        running += start_step(plan, &chains[started++], &first_error);
+      }
+    }
+  }
+
+  // Kill anything still running after cancellation or a poll failure
+  for (guint i = 0; i < n_chains; i++) {
+    if (chains[i].pid) {
+      kill(chains[i].pid, SIGKILL);
+      waitpid(chains[i].pid, NULL, 0);
+      finish_step(&chains[i]);
+    }
+  }
+
+  if (cancel_fd != -1) {
+    g_cancellable_release_fd(cancellable);
+  }
+  g_free(fds);
+  g_free(chains);
+
+  if (first_error) {
+    g_propagate_error(error, first_error);
+    return FALSE;
+  }
+  return TRUE;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <gio/gio.h>
+
+#include "config.h"
+
+/**
+ * Runs a command plan without a shell, using posix_spawn. Steps joined with
+ * && run in order and stop at the first failure. Groups of steps separated by
+ * `;` run one after another, or all at once if parallel is set. Blocks the
+ * calling thread; all children are killed once cancellable is cancelled.
+ * @return TRUE if every step that ran exited successfully.
+ */
+gboolean spawn_plan(const duet_command_plan_t *plan, gboolean parallel,
+                    GCancellable *cancellable, GError **error);
@@ -0,0 +1,131 @@
+#include "state.h"
+
+#include <errno.h>
+
+#define GROUP_STATE "State"
+
+static duet_context_t saved_context = {-1, -1, -1};
+static int saved_layout = -1;
+
+static gchar *state_path(void) {
+  const gchar *runtime_dir = g_getenv("XDG_RUNTIME_DIR");
+  if (!runtime_dir) {
+    return NULL;
+  }
+  return g_build_filename(runtime_dir, "duet", "state", NULL);
+}
+
+static gboolean get_int_in_range(GKeyFile *key_file, const gchar *key, int min,
+                                 int max, int *value) {
+  GError *error = NULL;
+  int read = g_key_file_get_integer(key_file, GROUP_STATE, key, &error);
+  if (error) {
+    g_error_free(error);
+    return FALSE;
+  }
+  if (read < min || read > max) {
+    return FALSE;
+  }
+  *value = read;
+  return TRUE;
+}
+
+// Reads a [State] group, leaving context and layout untouched if invalid
+static gboolean parse_state(GKeyFile *key_file, duet_context_t *context,
+                            int *layout) {
+  duet_context_t loaded;
+  int loaded_layout;
+  gboolean ok =
+      get_int_in_range(key_file, "KEYBOARD_CONNECTED", 0, 1,
+                       &loaded.keyboardConnected) &&
+      get_int_in_range(key_file, "ROTATION", ROTATION_LANDSCAPE,
+                       ROTATION_PORTRAIT_270, &loaded.rotation) &&
+      get_int_in_range(key_file, "MODE", MODE_AUTO, MODE_PORTRAIT_270,
+                       &loaded.mode) &&
+      get_int_in_range(key_file, "LAYOUT", -1, 4, &loaded_layout);
+  if (ok) {
+    *context = loaded;
+    *layout = loaded_layout;
+  }
+  return ok;
+}
+
+gboolean state_load(duet_context_t *context, int *layout) {
+  gchar *path = state_path();
+  if (!path) {
+    return FALSE;
+  }
+
+  GKeyFile *key_file = g_key_file_new();
+  gboolean ok =
+      g_key_file_load_from_file(key_file, path, G_KEY_FILE_NONE, NULL) &&
+      parse_state(key_file, context, layout);
+  g_key_file_unref(key_file);
+
+  if (ok) {
+    saved_context = *context;
+    saved_layout = *layout;
+  }
+  g_free(path);
+  return ok;
+}
+
+gchar *state_to_data(const duet_context_t *context, int layout,
+                     gsize *length) {
+  GKeyFile *key_file = g_key_file_new();
+  g_key_file_set_integer(key_file, GROUP_STATE, "KEYBOARD_CONNECTED",
+                         context->keyboardConnected ? 1 : 0);
+  g_key_file_set_integer(key_file, GROUP_STATE, "ROTATION", context->rotation);
+  g_key_file_set_integer(key_file, GROUP_STATE, "MODE", context->mode);
+  g_key_file_set_integer(key_file, GROUP_STATE, "LAYOUT", layout);
+  gchar *data = g_key_file_to_data(key_file, length, NULL);
+  g_key_file_unref(key_file);
+  return data;
+}
+
+gboolean state_from_data(const gchar *data, gsize length,
+                         duet_context_t *context, int *layout) {
+  GKeyFile *key_file = g_key_file_new();
+  gboolean ok = g_key_file_load_from_data(key_file, data, length,
+                                          G_KEY_FILE_NONE, NULL) &&
+                parse_state(key_file, context, layout);
+  g_key_file_unref(key_file);
+  return ok;
+}
+
+void state_save(const duet_context_t *context, int layout) {
+  if (context->keyboardConnected == saved_context.keyboardConnected &&
+      context->rotation == saved_context.rotation &&
+      context->mode == saved_context.mode && layout == saved_layout) {
+    return;
+  }
+
+  gchar *path = state_path();
+  if (!path) {
+    return;
+  }
+
+  gchar *dir = g_path_get_dirname(path);
+  if (g_mkdir_with_parents(dir, 0700) == -1) {
+    g_printerr("Failed to create %s: %s\n", dir, g_strerror(errno));
+    g_free(dir);
+    g_free(path);
+    return;
+  }
+  g_free(dir);
+
+  // g_file_set_contents() writes a temporary file and renames it over the
+  // old one, so a crash never leaves a partial state file behind
+  GError *error = NULL;
+  gsize length;
+  gchar *data = state_to_data(context, layout, &length);
+  if (g_file_set_contents(path, data, length, &error)) {
+    saved_context = *context;
+    saved_layout = layout;
+  } else {
+    g_printerr("Failed to save state: %s\n", error->message);
+    g_error_free(error);
+  }
+  g_free(data);
+  g_free(path);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <glib.h>
+
+#include "context.h"
+
+/**
+ * Loads the context and layout saved by a previous run from
+ * $XDG_RUNTIME_DIR/duet/state. The runtime directory lives as long as the
+ * user's session, so a saved layout is still what the compositor shows.
+ * @return FALSE if there is no valid saved state; context is left untouched.
+ */
+gboolean state_load(duet_context_t *context, int *layout);
+
+/**
+ * Saves the context and last applied layout, or -1 if none, atomically.
+ * Does nothing if neither changed since the last save.
+ */
+void state_save(const duet_context_t *context, int layout);
+
+/**
+ * Serializes the context and layout in the format of the state file.
+ * @return The newly allocated data, with its length in length.
+ */
+gchar *state_to_data(const duet_context_t *context, int layout, gsize *length);
+
+/**
+ * Parses data written by state_to_data().
+ * @return FALSE if data is not a valid state; context is left untouched.
+ */
+gboolean state_from_data(const gchar *data, gsize length,
+                         duet_context_t *context, int *layout);
@@ -0,0 +1,86 @@
+#include "trace.h"
+
+// Records kept, a power of two so indexes wrap with a mask
+#define TRACE_CAPACITY 4096
+#define TRACE_MASK (TRACE_CAPACITY - 1)
+
+typedef struct {
+  /** Index of the record plus one once written, 0 while being written */
+  gint seq;
+  guint id;
+  const char *name;
+  gint64 start;
+  /** Duration in microseconds, or -1 for an input event */
+  gint64 duration;
+  /** 1 for the main loop, 2 for worker threads */
+  gint tid;
+} trace_record_t;
+
+static trace_record_t ring[TRACE_CAPACITY];
+// Index of the next record to write, claimed by writers with an atomic add
+static gint next_record = 0;
+
+static GThread *main_thread = NULL;
+static guint last_id = 0;
+
+// Claims a slot and fills it. Readers skip slots whose seq does not match the
+// index they expect, so a slot being rewritten is never read half updated.
+static void record(guint id, const char *name, gint64 start,
+                   gint64 duration) {
+  guint index = (guint)g_atomic_int_add(&next_record, 1);
+  trace_record_t *slot = &ring[index & TRACE_MASK];
+  g_atomic_int_set(&slot->seq, 0);
+  slot->id = id;
+  slot->name = name;
+  slot->start = start;
+  slot->duration = duration;
+  slot->tid = g_thread_self() == main_thread ? 1 : 2;
+  g_atomic_int_set(&slot->seq, (gint)(index + 1));
+}
+
+guint trace_event(const char *source) {
+  main_thread = g_thread_self();
+  last_id++;
+  record(last_id, source, g_get_monotonic_time(), -1);
+  return last_id;
+}
+
+void trace_stage(guint id, const char *stage, gint64 start, gint64 end) {
+  if (id == 0) {
+    return;
+  }
+  record(id, stage, start, end - start);
+}
+
+gchar *trace_dump_json(void) {
+  guint end = (guint)g_atomic_int_get(&next_record);
+  guint begin = end > TRACE_CAPACITY ? end - TRACE_CAPACITY : 0;
+
+  GString *json = g_string_new("{\"traceEvents\":[");
+  gboolean first = TRUE;
+  for (guint index = begin; index != end; index++) {
+    const trace_record_t *slot = &ring[index & TRACE_MASK];
+    gint seq = g_atomic_int_get(&slot->seq);
+    trace_record_t copy = *slot;
+    if (seq != (gint)(index + 1) || g_atomic_int_get(&slot->seq) != seq) {
+      continue;
+    }
+
+    g_string_append_printf(json,
+                           "%s{\"name\":\"%s\",\"pid\":1,\"tid\":%d,"
+                           "\"ts\":%" G_GINT64_FORMAT,
+                           first ? "" : ",", copy.name, copy.tid, copy.start);
+    if (copy.duration == -1) {
+      g_string_append(json, ",\"ph\":\"i\",\"s\":\"p\",\"cat\":\"input\"");
+    } else {
+      g_string_append_printf(json,
+                             ",\"ph\":\"X\",\"dur\":%" G_GINT64_FORMAT
+                             ",\"cat\":\"stage\"",
+                             copy.duration);
+    }
+    g_string_append_printf(json, ",\"args\":{\"event\":%u}}", copy.id);
+    first = FALSE;
+  }
+  g_string_append(json, "],\"displayTimeUnit\":\"ms\"}");
+  return g_string_free(json, FALSE);
+}
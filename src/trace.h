@@ -0,0 +1,27 @@
+#pragma once
+
+#include <glib.h>
+
+/**
+ * Stamps an input event from source, e.g. "keyboard udev", with a new id and
+ * the current monotonic time. Callers pass the id along with the layout or
+ * brightness change the event causes, so its stages are attributed to it.
+ * @param source A string literal naming where the event came from.
+ * @return The event id.
+ */
+guint trace_event(const char *source);
+
+/**
+ * Records a stage of event id that ran from start to end, in monotonic
+ * microseconds. Safe to call from any thread and never blocks; once the ring
+ * buffer is full the oldest records are overwritten.
+ * @param stage A string literal naming the stage.
+ */
+void trace_stage(guint id, const char *stage, gint64 start, gint64 end);
+
+/**
+ * Formats the records still in the ring buffer as Chrome trace event JSON,
+ * loadable in chrome://tracing or Perfetto, on a single line.
+ * @return The newly allocated JSON.
+ */
+gchar *trace_dump_json(void);
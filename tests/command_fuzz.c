@@ -0,0 +1,50 @@
+// libFuzzer target for the command socket's line parser. The first byte picks
+// whether replies are sent from within the parser and where the rest of the
+// input is split into two writes. The daemon must answer and close the
+// connection whatever it is sent.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "harness.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  static duet_context_t context = {.keyboardConnected = 1,
+                                   .rotation = ROTATION_LANDSCAPE,
+                                   .mode = MODE_AUTO};
+  static gboolean started = FALSE;
+  if (!started) {
+    harness_start(&context, 4, 0);
+    started = TRUE;
+  }
+  if (size == 0) {
+    return 0;
+  }
+
+  uint8_t control = data[0];
+  data++;
+  size--;
+  harness_idle_sync = control & 1;
+  size_t split = (size_t)(control >> 1) % (size + 1);
+
+  int fd = harness_connect();
+  if (fd == -1) {
+    abort();
+  }
+  // Inputs stay well below the socket buffer, so the writes never block
+  if (send(fd, data, split, MSG_NOSIGNAL) == -1) {
+    abort();
+  }
+  harness_pump();
+  if (send(fd, data + split, size - split, MSG_NOSIGNAL) == -1) {
+    abort();
+  }
+  gchar **lines = harness_finish(fd);
+  if (!lines) {
+    abort();
+  }
+  g_strfreev(lines);
+  return 0;
+}
@@ -0,0 +1,150 @@
+// Feeds the command socket's line parser pipelined, split, overlong and
+// EOF-terminated input, with replies sent both from within the parser and
+// later from the main loop, then measures parse throughput.
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "harness.h"
+
+#define THROUGHPUT_REQUESTS 100000
+#define THROUGHPUT_TIMEOUT_US (30 * G_USEC_PER_SEC)
+
+typedef struct {
+  const char *name;
+  /** Written one at a time, NULL terminated */
+  const char *chunks[4];
+  /** The expected reply lines by prefix, NULL terminated */
+  const char *replies[4];
+} parse_case_t;
+
+static const parse_case_t cases[] = {
+    {"pipelined", {"subscribe\ntrace\n"}, {"state keyboard=", "trace []"}},
+    {"pipelined errors",
+     {"foo\nbar\n"},
+     {"error unknown event foo", "error unknown event bar"}},
+    {"split", {"mo", "de:", "9\n"}, {"error invalid mode 9"}},
+    {"split newline", {"trace", "\n"}, {"trace []"}},
+    {"eof terminated", {"foo"}, {"error unknown event foo"}},
+    {"eof after pipelined", {"trace\nfoo"}, {"trace []", "error unknown event foo"}},
+    {"crlf", {"trace\r\n"}, {"trace []"}},
+    {"mode", {"mode:1\n"}, {"ok landscape "}},
+    {"empty", {""}, {NULL}},
+};
+
+static gboolean check_case(const parse_case_t *test) {
+  gchar **lines = harness_exchange(test->chunks);
+  if (!lines) {
+    g_printerr("FAIL %s: connection not closed\n", test->name);
+    return FALSE;
+  }
+
+  gboolean ok = TRUE;
+  guint n = g_strv_length(lines);
+  guint expected = g_strv_length((gchar **)test->replies);
+  if (n != expected) {
+    g_printerr("FAIL %s: %u replies, expected %u\n", test->name, n, expected);
+    ok = FALSE;
+  }
+  for (guint i = 0; ok && i < n; i++) {
+    if (!g_str_has_prefix(lines[i], test->replies[i])) {
+      g_printerr("FAIL %s: reply %u is \"%s\", expected \"%s\"\n", test->name,
+                 i, lines[i], test->replies[i]);
+      ok = FALSE;
+    }
+  }
+  g_strfreev(lines);
+  return ok;
+}
+
+// A line longer than the limit is answered once and skipped, however it is
+// split, and the parser picks up again after it
+static gboolean check_overlong(void) {
+  gchar *long_line = g_strnfill(3000, 'x');
+  const parse_case_t test = {
+      "overlong",
+      {long_line, "x\ntrace\n"},
+      {"error line too long", "trace []"},
+  };
+  gboolean ok = check_case(&test);
+  g_free(long_line);
+  return ok;
+}
+
+// Pipelines requests as fast as the socket takes them and reads the replies
+static gboolean measure_throughput(void) {
+  int fd = harness_connect();
+  if (fd == -1) {
+    g_printerr("FAIL throughput: cannot connect\n");
+    return FALSE;
+  }
+
+  GString *requests = g_string_new(NULL);
+  for (guint i = 0; i < THROUGHPUT_REQUESTS; i++) {
+    g_string_append(requests, "trace\n");
+  }
+  gsize sent = 0;
+  guint replies = 0;
+  gint64 start = g_get_monotonic_time();
+  gint64 deadline = start + THROUGHPUT_TIMEOUT_US;
+  while (replies < THROUGHPUT_REQUESTS && g_get_monotonic_time() < deadline) {
+    if (sent < requests->len) {
+      ssize_t n = send(fd, requests->str + sent, requests->len - sent,
+                       MSG_DONTWAIT | MSG_NOSIGNAL);
+      if (n > 0) {
+        sent += n;
+      }
+    }
+    harness_pump();
+    char buffer[65536];
+    ssize_t n = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    for (ssize_t i = 0; i < n; i++) {
+      replies += buffer[i] == '\n';
+    }
+    if (n == 0) {
+      break;
+    }
+  }
+  gint64 elapsed = g_get_monotonic_time() - start;
+  close(fd);
+  g_string_free(requests, TRUE);
+
+  if (replies != THROUGHPUT_REQUESTS) {
+    g_printerr("FAIL throughput: %u of %d replies\n", replies,
+               THROUGHPUT_REQUESTS);
+    return FALSE;
+  }
+  printf("throughput (%s replies): %d requests in %.1f ms, %.0f requests/s\n",
+         harness_idle_sync ? "immediate" : "deferred", THROUGHPUT_REQUESTS,
+         elapsed / 1000.0, THROUGHPUT_REQUESTS * (double)G_USEC_PER_SEC / elapsed);
+  return TRUE;
+}
+
+int main(void) {
+  duet_context_t context = {.keyboardConnected = 1,
+                            .rotation = ROTATION_LANDSCAPE,
+                            .mode = MODE_AUTO};
+  harness_start(&context, 32, 0);
+
+  guint failed = 0;
+  const gboolean modes[] = {TRUE, FALSE};
+  for (gsize m = 0; m < G_N_ELEMENTS(modes); m++) {
+    harness_idle_sync = modes[m];
+    for (gsize i = 0; i < G_N_ELEMENTS(cases); i++) {
+      failed += !check_case(&cases[i]);
+    }
+    failed += !check_overlong();
+    failed += !measure_throughput();
+  }
+
+  harness_stop();
+  if (failed) {
+    g_printerr("%u checks failed\n", failed);
+    return 1;
+  }
+  printf("All parser checks passed\n");
+  return 0;
+}
@@ -0,0 +1,145 @@
+// Opens thousands of concurrent clients against the command socket, in
+// rounds, and checks every one is answered while memory stays flat. Prints
+// the reply latency percentiles and resident memory of each round.
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "harness.h"
+
+#define CLIENTS 2000
+#define ROUNDS 3
+#define MAX_CLIENTS 32
+#define ROUND_TIMEOUT_US (60 * G_USEC_PER_SEC)
+// Growth in resident memory between the first and last round still
+// considered flat
+#define MAX_RSS_GROWTH_KB 4096
+
+typedef struct {
+  int fd;
+  gint64 start;
+  gboolean answered;
+} stress_client_t;
+
+static long resident_kb(void) {
+  long pages = 0, resident = 0;
+  FILE *statm = fopen("/proc/self/statm", "r");
+  if (statm) {
+    if (fscanf(statm, "%ld %ld", &pages, &resident) != 2) {
+      resident = 0;
+    }
+    fclose(statm);
+  }
+  return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static int compare_latency(const void *a, const void *b) {
+  gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+  return (x > y) - (x < y);
+}
+
+// Connects every client and sends one request each, then serves them until
+// all were answered and closed
+static gboolean run_round(guint round, guint count) {
+  stress_client_t *clients = g_new0(stress_client_t, count);
+  gint64 *latencies = g_new0(gint64, count);
+  guint answered = 0, open = 0;
+
+  for (guint i = 0; i < count; i++) {
+    clients[i].fd = harness_connect();
+    if (clients[i].fd == -1) {
+      g_printerr("FAIL round %u: client %u cannot connect: %s\n", round, i,
+                 g_strerror(errno));
+      break;
+    }
+    open++;
+    clients[i].start = g_get_monotonic_time();
+    send(clients[i].fd, "trace\n", 6, MSG_NOSIGNAL);
+    shutdown(clients[i].fd, SHUT_WR);
+  }
+
+  gint64 deadline = g_get_monotonic_time() + ROUND_TIMEOUT_US;
+  while (open > 0 && g_get_monotonic_time() < deadline) {
+    harness_pump();
+    for (guint i = 0; i < count; i++) {
+      if (clients[i].fd == -1) {
+        continue;
+      }
+      char buffer[256];
+      ssize_t received = recv(clients[i].fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+      if (received > 0 && !clients[i].answered) {
+        clients[i].answered = TRUE;
+        latencies[answered++] = g_get_monotonic_time() - clients[i].start;
+      } else if (received == 0 ||
+                 (received == -1 && errno != EAGAIN && errno != EINTR)) {
+        close(clients[i].fd);
+        clients[i].fd = -1;
+        open--;
+      }
+    }
+  }
+  for (guint i = 0; i < count; i++) {
+    if (clients[i].fd != -1) {
+      close(clients[i].fd);
+    }
+  }
+
+  gboolean ok = answered == count;
+  if (!ok) {
+    g_printerr("FAIL round %u: %u of %u clients answered\n", round, answered,
+               count);
+  } else {
+    qsort(latencies, answered, sizeof(gint64), compare_latency);
+    printf("round %u: %u clients, latency p50 %.1f ms p99 %.1f ms max %.1f "
+           "ms, rss %ld KiB\n",
+           round, count, latencies[answered / 2] / 1000.0,
+           latencies[answered * 99 / 100] / 1000.0,
+           latencies[answered - 1] / 1000.0, resident_kb());
+  }
+  g_free(latencies);
+  g_free(clients);
+  return ok;
+}
+
+int main(void) {
+  // Every client is open at once on top of the sockets the daemon accepted
+  guint count = CLIENTS;
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    if (limit.rlim_cur < CLIENTS + MAX_CLIENTS + 64) {
+      count = limit.rlim_cur - MAX_CLIENTS - 64;
+      printf("Open file limit %ld, using %u clients\n",
+             (long)limit.rlim_cur, count);
+    }
+  }
+
+  duet_context_t context = {.keyboardConnected = 1,
+                            .rotation = ROTATION_LANDSCAPE,
+                            .mode = MODE_AUTO};
+  harness_start(&context, MAX_CLIENTS, 0);
+  harness_idle_sync = FALSE;
+
+  gboolean ok = TRUE;
+  long first_rss = 0;
+  for (guint round = 1; ok && round <= ROUNDS; round++) {
+    ok = run_round(round, count);
+    if (round == 1) {
+      first_rss = resident_kb();
+    }
+  }
+  long growth = resident_kb() - first_rss;
+  harness_stop();
+
+  if (ok && growth > MAX_RSS_GROWTH_KB) {
+    g_printerr("FAIL resident memory grew %ld KiB after the first round\n",
+               growth);
+    ok = FALSE;
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,160 @@
+#include "harness.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "brightness.h"
+#include "command.h"
+#include "display.h"
+#include "trace.h"
+
+// How long a client waits for the daemon to answer and close
+#define EXCHANGE_TIMEOUT_US (5 * G_USEC_PER_SEC)
+
+gboolean harness_idle_sync = TRUE;
+
+static duet_config_t config;
+static gchar *runtime_dir = NULL;
+
+typedef struct {
+  display_idle_func func;
+  gpointer data;
+} idle_waiter_t;
+
+static gboolean answer_waiter(gpointer data) {
+  idle_waiter_t *waiter = data;
+  waiter->func(HARNESS_LAYOUT, waiter->data);
+  g_free(waiter);
+  return G_SOURCE_REMOVE;
+}
+
+void display_when_idle(display_idle_func func, gpointer data) {
+  if (harness_idle_sync) {
+    func(HARNESS_LAYOUT, data);
+    return;
+  }
+  idle_waiter_t *waiter = g_new(idle_waiter_t, 1);
+  waiter->func = func;
+  waiter->data = data;
+  g_idle_add(answer_waiter, waiter);
+}
+
+void display_schedule_layout(duet_context_t *status, gboolean immediate,
+                             guint trace_id) {
+  command_publish_state();
+}
+
+int display_get_applied_layout(void) { return HARNESS_LAYOUT; }
+
+const char *display_layout_name(int id) {
+  return id == HARNESS_LAYOUT ? "landscape" : "unknown";
+}
+
+guint trace_event(const char *source) {
+  static guint last_id = 0;
+  return ++last_id;
+}
+
+void trace_stage(guint id, const char *stage, gint64 start, gint64 end) {}
+
+gchar *trace_dump_json(void) { return g_strdup("[]"); }
+
+gint brightness_get_percent(void) { return -1; }
+
+void harness_start(duet_context_t *context, gint max_clients,
+                   gint idle_timeout_ms) {
+  runtime_dir = g_dir_make_tmp("duet-test-XXXXXX", NULL);
+  g_assert(runtime_dir);
+  g_setenv("XDG_RUNTIME_DIR", runtime_dir, TRUE);
+
+  memset(&config, 0, sizeof(config));
+  config.max_clients = max_clients;
+  config.client_idle_timeout_ms = idle_timeout_ms;
+  command_watch(context, &config, -1);
+}
+
+void harness_stop(void) {
+  command_cleanup();
+  gchar *dir = g_build_filename(runtime_dir, "duet", NULL);
+  g_rmdir(dir);
+  g_free(dir);
+  g_rmdir(runtime_dir);
+  g_clear_pointer(&runtime_dir, g_free);
+}
+
+void harness_pump(void) {
+  while (g_main_context_iteration(NULL, FALSE)) {
+  }
+}
+
+int harness_connect(void) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  g_snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/duet/cmd.socket",
+             runtime_dir);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    return -1;
+  }
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+      fcntl(fd, F_SETFL, O_NONBLOCK) == -1) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+gchar **harness_exchange(const char *const *chunks) {
+  int fd = harness_connect();
+  if (fd == -1) {
+    return NULL;
+  }
+  for (const char *const *chunk = chunks; *chunk; chunk++) {
+    // The chunks are small enough for the socket buffer
+    if (send(fd, *chunk, strlen(*chunk), MSG_NOSIGNAL) == -1) {
+      close(fd);
+      return NULL;
+    }
+    harness_pump();
+  }
+  return harness_finish(fd);
+}
+
+gchar **harness_finish(int fd) {
+  shutdown(fd, SHUT_WR);
+
+  GString *replies = g_string_new(NULL);
+  gint64 deadline = g_get_monotonic_time() + EXCHANGE_TIMEOUT_US;
+  gboolean closed = FALSE;
+  while (!closed && g_get_monotonic_time() < deadline) {
+    harness_pump();
+    char buffer[4096];
+    ssize_t received = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (received > 0) {
+      g_string_append_len(replies, buffer, received);
+    } else if (received == 0 || (errno != EAGAIN && errno != EINTR)) {
+      closed = TRUE;
+    } else {
+      g_usleep(100);
+    }
+  }
+  close(fd);
+
+  if (!closed) {
+    g_string_free(replies, TRUE);
+    return NULL;
+  }
+  // Every reply ends with a newline, so the last part is always empty
+  if (replies->len > 0) {
+    g_string_truncate(replies, replies->len - 1);
+    gchar **lines = g_strsplit(replies->str, "\n", -1);
+    g_string_free(replies, TRUE);
+    return lines;
+  }
+  g_string_free(replies, TRUE);
+  return g_new0(gchar *, 1);
+}
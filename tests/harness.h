@@ -0,0 +1,48 @@
+#pragma once
+
+#include <glib.h>
+
+#include "config.h"
+#include "context.h"
+
+/**
+ * Stand-ins for the display, trace and brightness modules, so the command
+ * socket can be run on its own. Replies wait for display_when_idle(), which
+ * answers right away while harness_idle_sync is set, as the display module
+ * does when no layout update is running, and from an idle source otherwise.
+ */
+extern gboolean harness_idle_sync;
+
+/** The layout replies report as applied */
+#define HARNESS_LAYOUT 2
+
+/**
+ * Starts the command socket in a fresh temporary $XDG_RUNTIME_DIR with the
+ * given limits. Everything else in the config is left zero.
+ */
+void harness_start(duet_context_t *context, gint max_clients,
+                   gint idle_timeout_ms);
+
+/** Stops the command socket and removes the temporary directory */
+void harness_stop(void);
+
+/** Runs every pending main loop source */
+void harness_pump(void);
+
+/** Connects a non-blocking client to the command socket, or returns -1 */
+int harness_connect(void);
+
+/**
+ * Closes the write side of a client and collects its replies.
+ * @return The reply lines received until the daemon closed the connection,
+ * or NULL if it did not within a few seconds. fd is closed either way.
+ */
+gchar **harness_finish(int fd);
+
+/**
+ * Sends each chunk as its own write with the main loop run in between, so
+ * they arrive as separate reads, then closes the write side.
+ * @return The reply lines received until the daemon closed the connection,
+ * or NULL if it did not within a few seconds.
+ */
+gchar **harness_exchange(const char *const *chunks);